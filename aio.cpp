@@ -0,0 +1,284 @@
+#include "aio.h"
+
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// linux/fs.h, pulled in by io_uring.h, has a BLOCK_SIZE of its own.
+#undef BLOCK_SIZE
+
+#include "disk.h"
+
+AsyncIO::AsyncIO(int fd, const unsigned &queue_depth) {
+  this->fd = fd;
+  this->queue_depth = queue_depth > 0 ? queue_depth : 1;
+  this->in_flight = 0;
+}
+
+AsyncIO *AsyncIO::create(int fd, const unsigned &queue_depth, const bool &allow_uring) {
+  if (allow_uring) {
+    UringIO *uring = new UringIO(fd, queue_depth);
+
+    if (uring->ready()) return uring;
+
+    delete uring;
+  }
+
+  return new ThreadPoolIO(fd, queue_depth);
+}
+
+/* * * * * * * * * * * * * *
+ *                         *
+ *        io_uring         *
+ *                         *
+ * * * * * * * * * * * * * *
+ */
+
+UringIO::UringIO(int fd, const unsigned &queue_depth) : AsyncIO(fd, queue_depth) {
+  struct io_uring_params params;
+  void *addr;
+  unsigned index;
+
+  sq_ring = cq_ring = nullptr;
+  sqes = nullptr;
+
+  memset(&params, 0, sizeof(params));
+
+  if ((ring_fd = syscall(__NR_io_uring_setup, this->queue_depth, &params)) < 0) {
+    ring_fd = -1;
+    return;
+  }
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  // Newer kernels map both rings with one mmap.
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (cq_ring_size > sq_ring_size) sq_ring_size = cq_ring_size;
+    cq_ring_size = sq_ring_size;
+  }
+
+  addr = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+  if (addr == MAP_FAILED) goto fail;
+  sq_ring = (uint8_t *)addr;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring = sq_ring;
+  } else {
+    addr = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (addr == MAP_FAILED) goto fail;
+    cq_ring = (uint8_t *)addr;
+  }
+
+  addr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (addr == MAP_FAILED) goto fail;
+  sqes = (struct io_uring_sqe *)addr;
+
+  sq_head = (unsigned *)(sq_ring + params.sq_off.head);
+  sq_tail = (unsigned *)(sq_ring + params.sq_off.tail);
+  sq_mask = (unsigned *)(sq_ring + params.sq_off.ring_mask);
+  sq_array = (unsigned *)(sq_ring + params.sq_off.array);
+
+  cq_head = (unsigned *)(cq_ring + params.cq_off.head);
+  cq_tail = (unsigned *)(cq_ring + params.cq_off.tail);
+  cq_mask = (unsigned *)(cq_ring + params.cq_off.ring_mask);
+  cqes = (struct io_uring_cqe *)(cq_ring + params.cq_off.cqes);
+
+  // One slot per request in flight, its index is the request's user_data.
+  slots.resize(this->queue_depth);
+  iovecs.resize(this->queue_depth);
+  for (index = 0; index < this->queue_depth; index++) {
+    slots[index].iov = &iovecs[index];
+    free_slots.push_back(this->queue_depth - 1 - index);
+  }
+
+  return;
+
+fail:
+  if (cq_ring != nullptr && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+  if (sq_ring != nullptr) munmap(sq_ring, sq_ring_size);
+  sq_ring = cq_ring = nullptr;
+  close(ring_fd);
+  ring_fd = -1;
+}
+
+UringIO::~UringIO() {
+  std::vector<aio_request> done;
+
+  if (ring_fd == -1) return;
+
+  // The kernel may still be using buffers of requests in flight.
+  while (in_flight > 0 && complete(done, in_flight) >= 0) done.clear();
+
+  munmap(sqes, sqes_size);
+  if (cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+  munmap(sq_ring, sq_ring_size);
+  close(ring_fd);
+}
+
+bool UringIO::submit(const aio_request &request) {
+  struct io_uring_sqe *sqe;
+  unsigned tail, index, slot_index;
+
+  if (full() || free_slots.empty()) return false;
+
+  slot_index = free_slots.back();
+  free_slots.pop_back();
+
+  slots[slot_index].request = request;
+  slots[slot_index].iov->iov_base = request.blk;
+  slots[slot_index].iov->iov_len = BLOCK_SIZE;
+
+  tail = *sq_tail;
+  index = tail & *sq_mask;
+  sqe = &sqes[index];
+
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = request.is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+  sqe->fd = fd;
+  sqe->addr = (unsigned long)slots[slot_index].iov;
+  sqe->len = 1;
+  sqe->off = (uint64_t)request.block_no * BLOCK_SIZE;
+  sqe->user_data = slot_index;
+
+  sq_array[index] = index;
+  __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  if (syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0) != 1) {
+    // The kernel didn't take it, take it back out of the ring.
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+    free_slots.push_back(slot_index);
+    return false;
+  }
+
+  in_flight++;
+
+  return true;
+}
+
+int UringIO::complete(std::vector<aio_request> &done, unsigned min) {
+  struct io_uring_cqe *cqe;
+  unsigned head, tail, slot_index;
+  int count = 0;
+
+  if (min > in_flight) min = in_flight;
+
+  while (true) {
+    head = *cq_head;
+    tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+      cqe = &cqes[head & *cq_mask];
+      slot_index = cqe->user_data;
+
+      slots[slot_index].request.result = cqe->res == BLOCK_SIZE ? 0 : -1;
+      done.push_back(slots[slot_index].request);
+      free_slots.push_back(slot_index);
+
+      in_flight--;
+      count++;
+    }
+
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+
+    if (count >= (int)min) return count;
+
+    if (syscall(__NR_io_uring_enter, ring_fd, 0, min - count, IORING_ENTER_GETEVENTS, nullptr, 0) < 0) return -1;
+  }
+}
+
+/* * * * * * * * * * * * * *
+ *                         *
+ *       Thread pool       *
+ *                         *
+ * * * * * * * * * * * * * *
+ */
+
+ThreadPoolIO::ThreadPoolIO(int fd, const unsigned &queue_depth) : AsyncIO(fd, queue_depth) {
+  unsigned index, count;
+
+  stopping = false;
+
+  // More threads than requests in flight would only sit idle.
+  count = std::thread::hardware_concurrency();
+  if (count == 0 || count > this->queue_depth) count = this->queue_depth;
+
+  for (index = 0; index < count; index++) workers.push_back(std::thread(&ThreadPoolIO::work, this));
+}
+
+ThreadPoolIO::~ThreadPoolIO() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+
+  has_pending.notify_all();
+
+  for (std::thread &worker : workers) worker.join();
+}
+
+void ThreadPoolIO::work() {
+  aio_request request;
+  ssize_t res;
+
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      has_pending.wait(guard, [this] { return stopping || !pending.empty(); });
+
+      // Requests still queued are finished before stopping.
+      if (pending.empty()) return;
+
+      request = pending.front();
+      pending.pop_front();
+    }
+
+    if (request.is_write)
+      res = pwrite(fd, request.blk, BLOCK_SIZE, (off_t)request.block_no * BLOCK_SIZE);
+    else
+      res = pread(fd, request.blk, BLOCK_SIZE, (off_t)request.block_no * BLOCK_SIZE);
+
+    request.result = res == BLOCK_SIZE ? 0 : -1;
+
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      finished.push_back(request);
+    }
+
+    has_finished.notify_one();
+  }
+}
+
+bool ThreadPoolIO::submit(const aio_request &request) {
+  if (full()) return false;
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    pending.push_back(request);
+  }
+
+  in_flight++;
+  has_pending.notify_one();
+
+  return true;
+}
+
+int ThreadPoolIO::complete(std::vector<aio_request> &done, unsigned min) {
+  int count;
+
+  if (min > in_flight) min = in_flight;
+
+  std::unique_lock<std::mutex> guard(lock);
+  has_finished.wait(guard, [this, min] { return finished.size() >= min; });
+
+  count = finished.size();
+  done.insert(done.end(), finished.begin(), finished.end());
+  finished.clear();
+
+  in_flight -= count;
+
+  return count;
+}
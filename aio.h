@@ -0,0 +1,112 @@
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef __AIO_H__
+#define __AIO_H__
+
+#define AIO_QUEUE_DEPTH 16
+
+#define AIO_ENGINE_URING 0x00
+#define AIO_ENGINE_THREADS 0x01
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// one asynchronous block request
+struct aio_request {
+  unsigned block_no;  // Block number on disk
+  uint8_t *blk;       // BLOCK_SIZE bytes to read into / write from
+  bool is_write;      // Write (true) or read (false)
+  int result;         // 0 when done, -1 on a failed or short transfer
+};
+
+// Submit/complete block I/O on a disk file with at most queue_depth
+// requests in flight.
+class AsyncIO {
+ protected:
+  int fd;
+  unsigned queue_depth;
+  unsigned in_flight;
+
+ public:
+  AsyncIO(int fd, const unsigned &queue_depth);
+  virtual ~AsyncIO() {}
+
+  // Uses io_uring when the kernel allows it, otherwise a pool of threads
+  // doing pread/pwrite.
+  static AsyncIO *create(int fd, const unsigned &queue_depth = AIO_QUEUE_DEPTH, const bool &allow_uring = true);
+
+  // queues one request, returns false when the queue is full
+  virtual bool submit(const aio_request &request) = 0;
+  // waits until at least min requests are done and appends them to done,
+  // returns how many were appended
+  virtual int complete(std::vector<aio_request> &done, unsigned min = 1) = 0;
+  virtual uint8_t get_engine() = 0;
+
+  unsigned get_queue_depth() { return queue_depth; }
+  unsigned get_in_flight() { return in_flight; }
+  bool full() { return in_flight >= queue_depth; }
+};
+
+// io_uring driven directly through its system calls.
+class UringIO : public AsyncIO {
+ private:
+  struct slot {
+    aio_request request;
+    struct iovec *iov;
+  };
+
+  int ring_fd;
+  uint8_t *sq_ring, *cq_ring;
+  size_t sq_ring_size, cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  std::vector<slot> slots;
+  std::vector<struct iovec> iovecs;
+  std::vector<unsigned> free_slots;
+
+ public:
+  UringIO(int fd, const unsigned &queue_depth);
+  ~UringIO();
+
+  // false if the kernel refused to set up the ring
+  bool ready() { return ring_fd != -1; }
+
+  bool submit(const aio_request &request);
+  int complete(std::vector<aio_request> &done, unsigned min = 1);
+  uint8_t get_engine() { return AIO_ENGINE_URING; }
+};
+
+// Fallback when io_uring isn't available: worker threads doing pread/pwrite.
+class ThreadPoolIO : public AsyncIO {
+ private:
+  std::vector<std::thread> workers;
+  std::deque<aio_request> pending;
+  std::vector<aio_request> finished;
+  std::mutex lock;
+  std::condition_variable has_pending, has_finished;
+  bool stopping;
+
+  void work();
+
+ public:
+  ThreadPoolIO(int fd, const unsigned &queue_depth);
+  ~ThreadPoolIO();
+
+  bool submit(const aio_request &request);
+  int complete(std::vector<aio_request> &done, unsigned min = 1);
+  uint8_t get_engine() { return AIO_ENGINE_THREADS; }
+};
+
+#endif  // __AIO_H__
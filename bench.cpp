@@ -0,0 +1,90 @@
+// Compares the disk backends on a scratch image: sequential writes of
+// file-sized runs through write_blocks followed by sync, then reads of the
+// same runs through read_blocks.
+//
+//     ./bench [runs] [blocks per run]
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#include "disk.h"
+
+#define BENCH_DISKNAME "bench_disk.bin"
+
+static double
+seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void
+bench(const uint8_t &backend, const char *name, unsigned runs, unsigned run_len)
+{
+    Disk disk(backend, BENCH_DISKNAME);
+    if (disk.get_backend() != backend) {
+        printf("%-8s skipped, backend not available\n", name);
+        return;
+    }
+    disk.set_async(false);
+    // one sync per run is what's measured
+    disk.set_write_mode(DISK_WRITE_BACK);
+
+    // plain heap buffers, the direct backend has to bounce these itself
+    std::vector<uint8_t> data(run_len * BLOCK_SIZE);
+    for (unsigned i = 0; i < data.size(); i++)
+        data[i] = (uint8_t)(i * 31 + backend);
+    std::vector<block_io> blocks(run_len);
+
+    double mb = (double)runs * run_len * BLOCK_SIZE / (1024 * 1024);
+    unsigned first_blk = 2;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < runs; r++) {
+        unsigned base = first_blk + (r * run_len) % (disk.get_no_blocks() - first_blk - run_len);
+        for (unsigned i = 0; i < run_len; i++) {
+            blocks[i].block_no = base + i;
+            blocks[i].blk = data.data() + i * BLOCK_SIZE;
+        }
+        if (disk.write_blocks(blocks) != 0) {
+            printf("%-8s write failed\n", name);
+            return;
+        }
+    }
+    disk.sync();
+    double write_time = seconds_since(start);
+
+    start = std::chrono::steady_clock::now();
+    for (unsigned r = 0; r < runs; r++) {
+        unsigned base = first_blk + (r * run_len) % (disk.get_no_blocks() - first_blk - run_len);
+        for (unsigned i = 0; i < run_len; i++)
+            blocks[i].block_no = base + i;
+        if (disk.read_blocks(blocks) != 0) {
+            printf("%-8s read failed\n", name);
+            return;
+        }
+    }
+    double read_time = seconds_since(start);
+
+    printf("%-8s write+sync %8.1f MB/s   read %8.1f MB/s\n", name, mb / write_time, mb / read_time);
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned runs = argc > 1 ? atoi(argv[1]) : 512;
+    unsigned run_len = argc > 2 ? atoi(argv[2]) : 16;
+    if (runs == 0 || run_len == 0 || run_len > 1024) {
+        std::cerr << "usage: " << argv[0] << " [runs] [blocks per run (1-1024)]" << std::endl;
+        return 1;
+    }
+
+    printf("%u runs of %u blocks\n", runs, run_len);
+    bench(DISK_BACKEND_STREAM, "stream", runs, run_len);
+    bench(DISK_BACKEND_MMAP, "mmap", runs, run_len);
+    bench(DISK_BACKEND_PIO, "pio", runs, run_len);
+    bench(DISK_BACKEND_DIRECT, "direct", runs, run_len);
+    unlink(BENCH_DISKNAME);
+    return 0;
+}
@@ -0,0 +1,151 @@
+#include "cache.h"
+
+#include <string.h>
+
+BlockCache::BlockCache(Disk *disk, const unsigned &capacity) {
+  this->disk = disk;
+  this->capacity = capacity > 0 ? capacity : 1;
+  this->hits = 0;
+  this->misses = 0;
+}
+
+// Finds a cached block and marks it as the most recently used.
+cache_block *BlockCache::lookup(unsigned block_no) {
+  std::unordered_map<unsigned, std::list<cache_block>::iterator>::iterator it;
+
+  if ((it = blocks.find(block_no)) == blocks.end()) return nullptr;
+
+  lru.splice(lru.begin(), lru, it->second);
+
+  return &lru.front();
+}
+
+// Makes room for a block and returns its (uninitialized) cache slot.
+cache_block *BlockCache::insert(unsigned block_no) {
+  while (lru.size() >= capacity) evict();
+
+  lru.emplace_front();
+  lru.front().block_no = block_no;
+  blocks[block_no] = lru.begin();
+
+  return &lru.front();
+}
+
+// Copies a block into the cache, replacing any older copy.
+void BlockCache::store(unsigned block_no, const uint8_t *blk) {
+  cache_block *entry;
+
+  if ((entry = lookup(block_no)) == nullptr) entry = insert(block_no);
+
+  memcpy(entry->data, blk, BLOCK_SIZE);
+}
+
+// Drops the least recently used block.
+void BlockCache::evict() {
+  if (lru.empty()) return;
+
+  blocks.erase(lru.back().block_no);
+  lru.pop_back();
+}
+
+int BlockCache::read(unsigned block_no, uint8_t *blk) {
+  const uint8_t *data;
+
+  if ((data = read_ptr(block_no)) == nullptr) return -1;
+
+  memcpy(blk, data, BLOCK_SIZE);
+
+  return 0;
+}
+
+int BlockCache::write(unsigned block_no, uint8_t *blk) {
+  if (disk->write(block_no, blk) != 0) return -1;
+
+  store(block_no, blk);
+
+  return 0;
+}
+
+const uint8_t *BlockCache::read_ptr(unsigned block_no) {
+  cache_block *entry;
+
+  if ((entry = lookup(block_no)) != nullptr) {
+    hits++;
+    return entry->data;
+  }
+
+  misses++;
+
+  entry = insert(block_no);
+
+  if (disk->read(block_no, entry->data) != 0) {
+    invalidate(block_no);
+    return nullptr;
+  }
+
+  return entry->data;
+}
+
+const uint8_t *BlockCache::peek(unsigned block_no) {
+  cache_block *entry;
+
+  if ((entry = lookup(block_no)) == nullptr) {
+    misses++;
+    return nullptr;
+  }
+
+  hits++;
+
+  return entry->data;
+}
+
+int BlockCache::read_blocks(std::vector<block_io> &blocks) {
+  std::vector<block_io> missed;
+  cache_block *entry;
+
+  for (block_io &io : blocks) {
+    if ((entry = lookup(io.block_no)) != nullptr) {
+      hits++;
+      memcpy(io.blk, entry->data, BLOCK_SIZE);
+    } else {
+      misses++;
+      missed.push_back(io);
+    }
+  }
+
+  if (missed.empty()) return 0;
+
+  if (disk->read_blocks(missed) != 0) return -1;
+
+  for (block_io &io : missed) store(io.block_no, io.blk);
+
+  return 0;
+}
+
+int BlockCache::write_blocks(std::vector<block_io> &blocks) {
+  if (disk->write_blocks(blocks) != 0) return -1;
+
+  for (block_io &io : blocks) store(io.block_no, io.blk);
+
+  return 0;
+}
+
+void BlockCache::invalidate(unsigned block_no) {
+  std::unordered_map<unsigned, std::list<cache_block>::iterator>::iterator it;
+
+  if ((it = blocks.find(block_no)) == blocks.end()) return;
+
+  lru.erase(it->second);
+  blocks.erase(it);
+}
+
+void BlockCache::clear() {
+  lru.clear();
+  blocks.clear();
+}
+
+void BlockCache::set_capacity(const unsigned &capacity) {
+  this->capacity = capacity > 0 ? capacity : 1;
+
+  while (lru.size() > this->capacity) evict();
+}
@@ -0,0 +1,71 @@
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+#include "disk.h"
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#define CACHE_DEFAULT_CAPACITY 256
+
+struct cache_block {
+  unsigned block_no;         // Block number on disk
+  uint8_t data[BLOCK_SIZE];  // Cached copy of the block
+};
+
+// Write-through LRU cache of disk blocks, sits between FS and Disk.
+class BlockCache {
+ private:
+  Disk *disk;
+  unsigned capacity;
+  // most recently used block first
+  std::list<cache_block> lru;
+  std::unordered_map<unsigned, std::list<cache_block>::iterator> blocks;
+
+  unsigned long hits;
+  unsigned long misses;
+
+  cache_block *lookup(unsigned block_no);
+  cache_block *insert(unsigned block_no);
+  void evict();
+
+ public:
+  BlockCache(Disk *disk, const unsigned &capacity = CACHE_DEFAULT_CAPACITY);
+
+  // reads one block, from the cache if it's there
+  int read(unsigned block_no, uint8_t *blk);
+  // writes one block to the disk and keeps a copy in the cache
+  int write(unsigned block_no, uint8_t *blk);
+  // returns a pointer to the cached copy of one block, nullptr on an invalid
+  // block number. Only valid until the next call into the cache
+  const uint8_t *read_ptr(unsigned block_no);
+  // reads several blocks, the ones not in the cache with one vectored read
+  int read_blocks(std::vector<block_io> &blocks);
+  // writes several blocks with one vectored write and caches them
+  int write_blocks(std::vector<block_io> &blocks);
+
+  // returns the cached copy of one block, nullptr if it isn't cached. The
+  // block is never read from the disk
+  const uint8_t *peek(unsigned block_no);
+  // caches a block that was read or written around the cache
+  void store(unsigned block_no, const uint8_t *blk);
+
+  // drops one block from the cache
+  void invalidate(unsigned block_no);
+  // drops every block from the cache
+  void clear();
+
+  void set_capacity(const unsigned &capacity);
+  unsigned get_capacity() { return capacity; }
+  unsigned get_size() { return lru.size(); }
+  unsigned long get_hits() { return hits; }
+  unsigned long get_misses() { return misses; }
+  void reset_stats() {
+    hits = 0;
+    misses = 0;
+  }
+};
+
+#endif  // __CACHE_H__
@@ -0,0 +1,197 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "constants.h"
+
+#ifndef __CODEC_H__
+#define __CODEC_H__
+
+// Every integer on the disk is little-endian: FAT entries, the size and
+// first block of an entry's attributes and the index of a directory child.
+
+// Where the fields are in the attributes of an entry.
+#define F_NAME_OFFSET 0
+#define F_SIZE_OFFSET (F_NAME_OFFSET + F_NAME_SIZE)
+#define F_FIRST_BLOCK_OFFSET (F_SIZE_OFFSET + F_SIZE_SIZE)
+#define F_TYPE_OFFSET (F_FIRST_BLOCK_OFFSET + F_FIRST_BLOCK_SIZE)
+#define F_ACCESS_RIGHTS_OFFSET (F_TYPE_OFFSET + F_TYPE_SIZE)
+
+// Where the fields are in a directory child, the hash of its name is
+// stored so a directory is indexed without hashing every name, and the
+// size, type and access rights of the entry so it's listed without reading
+// its first block.
+#define C_NAME_OFFSET 0
+#define C_INDEX_OFFSET F_NAME_SIZE
+#define C_HASH_OFFSET (C_INDEX_OFFSET + 4)
+#define C_SIZE_OFFSET (C_HASH_OFFSET + 4)
+#define C_TYPE_OFFSET (C_SIZE_OFFSET + F_SIZE_SIZE)
+#define C_ACCESS_RIGHTS_OFFSET (C_TYPE_OFFSET + F_TYPE_SIZE)
+
+// Where the fields are in the header of a directory node, at the start of
+// the content of each block of the directory. A leaf links to the next leaf,
+// 0 for the last one, an internal node to its first subtree. The root also
+// has the first block of the directory listing this one and a Bloom filter
+// of the names of the whole directory, both are 0 in the other nodes.
+#define N_TYPE_OFFSET 0
+#define N_COUNT_OFFSET 4
+#define N_LINK_OFFSET 8
+#define N_PARENT_OFFSET 12
+#define N_BLOOM_OFFSET 16
+#define BLOOM_PROBES 3
+// a filter with more bits set than this is past use, about 1 in 8 names it
+// doesn't have pass with 3 probes, lookups stop checking it
+#define BLOOM_MAX_BITS (DIR_BLOOM_SIZE * 8 / 2)
+#define NODE_LEAF 0
+#define NODE_INTERNAL 1
+
+namespace codec {
+
+inline uint32_t to_le32(uint32_t value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  return value;
+#else
+  return __builtin_bswap32(value);
+#endif
+}
+
+// Reads one little-endian integer, memcpy so it may be unaligned.
+inline uint32_t get_le32(const uint8_t *src) {
+  uint32_t value;
+
+  memcpy(&value, src, sizeof(value));
+
+  return to_le32(value);
+}
+
+inline void put_le32(uint8_t *dst, uint32_t value) {
+  value = to_le32(value);
+  memcpy(dst, &value, sizeof(value));
+}
+
+// Decodes count FAT entries, a single memcpy on little-endian hosts.
+inline void decode_le32(int32_t *dst, const uint8_t *src, const size_t &count) {
+  memcpy(dst, src, count * sizeof(int32_t));
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+  for (size_t index = 0; index < count; index++) dst[index] = __builtin_bswap32(dst[index]);
+#endif
+}
+
+// Encodes count FAT entries, a single memcpy on little-endian hosts.
+inline void encode_le32(uint8_t *dst, const int32_t *src, const size_t &count) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(dst, src, count * sizeof(int32_t));
+#else
+  for (size_t index = 0; index < count; index++) put_le32(dst + index * sizeof(int32_t), src[index]);
+#endif
+}
+
+// Fills the attributes of an entry, works for FS's dir_entry and
+// fs_obj::dir_entry. Bytes past the fields are left as they are.
+template <typename Entry>
+inline void encode_attr(uint8_t *attr, const Entry &entry) {
+  memcpy(attr + F_NAME_OFFSET, entry.file_name, F_NAME_SIZE);
+  put_le32(attr + F_SIZE_OFFSET, entry.size);
+  put_le32(attr + F_FIRST_BLOCK_OFFSET, entry.first_blk);
+  attr[F_TYPE_OFFSET] = entry.type;
+  attr[F_ACCESS_RIGHTS_OFFSET] = entry.access_rights;
+}
+
+template <typename Entry>
+inline void decode_attr(Entry &entry, const uint8_t *attr) {
+  memcpy(entry.file_name, attr + F_NAME_OFFSET, F_NAME_SIZE);
+  entry.size = get_le32(attr + F_SIZE_OFFSET);
+  entry.first_blk = get_le32(attr + F_FIRST_BLOCK_OFFSET);
+  entry.type = attr[F_TYPE_OFFSET];
+  entry.access_rights = attr[F_ACCESS_RIGHTS_OFFSET];
+}
+
+// FNV-1a of a file name, up to its terminating zero or F_NAME_SIZE bytes.
+inline uint32_t name_hash(const char *file_name) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t index = 0; index < F_NAME_SIZE && file_name[index] != 0; index++) hash = (hash ^ (uint8_t)file_name[index]) * 16777619u;
+
+  return hash;
+}
+
+// One directory child, DIR_CHILD_SIZE bytes, the hash is taken from the name.
+inline void encode_child(uint8_t *dst, const char *file_name, const uint32_t &index) {
+  memcpy(dst + C_NAME_OFFSET, file_name, F_NAME_SIZE);
+  put_le32(dst + C_INDEX_OFFSET, index);
+  put_le32(dst + C_HASH_OFFSET, name_hash(file_name));
+}
+
+inline void decode_child(char *file_name, uint32_t &index, const uint8_t *src) {
+  memcpy(file_name, src + C_NAME_OFFSET, F_NAME_SIZE);
+  index = get_le32(src + C_INDEX_OFFSET);
+}
+
+// One key of an internal directory node, DIR_KEY_SIZE bytes: the first name
+// in a subtree and its block. decode_child reads it back.
+inline void encode_key(uint8_t *dst, const char *file_name, const uint32_t &block) {
+  memcpy(dst + C_NAME_OFFSET, file_name, F_NAME_SIZE);
+  put_le32(dst + C_INDEX_OFFSET, block);
+}
+
+// The stored hash of a child's name.
+inline uint32_t decode_child_hash(const uint8_t *src) { return get_le32(src + C_HASH_OFFSET); }
+
+// The size, type and access rights of a child, from anything that has them.
+template <typename Entry>
+inline void encode_child_attr(uint8_t *dst, const Entry &entry) {
+  put_le32(dst + C_SIZE_OFFSET, entry.size);
+  dst[C_TYPE_OFFSET] = entry.type;
+  dst[C_ACCESS_RIGHTS_OFFSET] = entry.access_rights;
+}
+
+template <typename Entry>
+inline void decode_child_attr(Entry &entry, const uint8_t *src) {
+  entry.size = get_le32(src + C_SIZE_OFFSET);
+  entry.type = src[C_TYPE_OFFSET];
+  entry.access_rights = src[C_ACCESS_RIGHTS_OFFSET];
+}
+
+// The bit of a name hash in a filter of DIR_BLOOM_SIZE bytes for each probe,
+// both halves of the hash make up the probes.
+inline unsigned bloom_bit(const uint32_t &hash, const unsigned &probe) { return ((hash & 0xffff) + probe * (hash >> 16)) % (DIR_BLOOM_SIZE * 8); }
+
+// Adds a name hash to a filter, returns whether a bit was set.
+inline bool bloom_add(uint8_t *bloom, const uint32_t &hash) {
+  unsigned probe, bit;
+  bool grown = false;
+
+  for (probe = 0; probe < BLOOM_PROBES; probe++) {
+    bit = bloom_bit(hash, probe);
+    grown = grown || (bloom[bit / 8] & (1 << (bit % 8))) == 0;
+    bloom[bit / 8] |= 1 << (bit % 8);
+  }
+
+  return grown;
+}
+
+// Whether a name hash may be in a filter, false means it certainly isn't.
+inline bool bloom_test(const uint8_t *bloom, const uint32_t &hash) {
+  unsigned probe, bit;
+
+  for (probe = 0; probe < BLOOM_PROBES; probe++) {
+    bit = bloom_bit(hash, probe);
+
+    if ((bloom[bit / 8] & (1 << (bit % 8))) == 0) return false;
+  }
+
+  return true;
+}
+
+// Whether a filter has too many bits set to tell names apart.
+inline bool bloom_full(const uint8_t *bloom) {
+  unsigned index, bits = 0;
+
+  for (index = 0; index < DIR_BLOOM_SIZE; index++) bits += __builtin_popcount(bloom[index]);
+
+  return bits > BLOOM_MAX_BITS;
+}
+
+}  // namespace codec
+
+#endif  // __CODEC_H__
@@ -2,15 +2,20 @@
 #define __CONSTANTS_H__
 
 #define ENTRY_SIZE 4096
-#define ENTRY_CONTENT_SIZE 4032
-#define ENTRY_ATTRIBUTE_SIZE 64
+#define ENTRY_CONTENT_SIZE 4024
+#define ENTRY_ATTRIBUTE_SIZE 72
 
 #define F_NAME_SIZE 56
 #define F_SIZE_SIZE 4
-#define F_FIRST_BLOCK_SIZE 2
+#define F_FIRST_BLOCK_SIZE 4
 #define F_TYPE_SIZE 1
 #define F_ACCESS_RIGHTS_SIZE 1
 
-#define DIR_CHILD_SIZE 58
+#define DIR_CHILD_SIZE 72
+#define DIR_KEY_SIZE 60
+#define DIR_BLOOM_SIZE 40
+#define DIR_NODE_HEADER_SIZE (16 + DIR_BLOOM_SIZE)
+#define DIR_LEAF_CHILDREN ((ENTRY_CONTENT_SIZE - DIR_NODE_HEADER_SIZE) / DIR_CHILD_SIZE)
+#define DIR_NODE_KEYS ((ENTRY_CONTENT_SIZE - DIR_NODE_HEADER_SIZE) / DIR_KEY_SIZE)
 
 #endif //__CONSTANTS_H__
@@ -3,7 +3,7 @@
 struct dir_entry {
     char file_name[56]; // name of the file / sub-directory
     uint32_t size; // size of the file in bytes
-    uint16_t first_blk; // index in the FAT for the first block of the file
+    uint32_t first_blk; // index in the FAT for the first block of the file
     uint8_t type; // directory (1) or file (0)
     uint8_t access_rights; // read (0x04), write (0x02), execute (0x01)
 };
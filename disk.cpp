@@ -1,28 +1,165 @@
 #include <iostream>
 #include "disk.h"
 #include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
-Disk::Disk()
+uint8_t Disk::default_backend = DISK_BACKEND_MMAP;
+uint8_t Disk::default_write_mode = DISK_WRITE_THROUGH;
+
+Disk::Disk(const uint8_t &backend, const std::string &name) : pool(BLOCK_SIZE)
 {
+    this->diskname = name;
+    this->backend = backend;
+    this->fd = -1;
+    this->map = nullptr;
+    this->write_mode = default_write_mode;
+    this->dirty_threshold = DISK_DIRTY_THRESHOLD;
+    this->aio = nullptr;
+    this->aio_fd = -1;
+    this->async = true;
+    this->no_blocks = DISK_DEFAULT_BLOCKS;
+
     // first check if the disk file exists, otherwise create it.
-    if (!disk_file_exists(DISKNAME)) {
+    if (!disk_file_exists(diskname)) {
         std::cout << "No disk file found...\n";
-        std::cout << "Creating disk file: " << DISKNAME << std::endl;
-        std::ofstream f(DISKNAME, std::ios::binary | std::ios::out);
-        f.seekp((1<<23)-1);
+        std::cout << "Creating disk file: " << diskname << std::endl;
+        std::ofstream f(diskname.c_str(), std::ios::binary | std::ios::out);
+        f.seekp((uint64_t)DISK_DEFAULT_BLOCKS * BLOCK_SIZE - 1);
         f.write("", 1);
     }
+    // the geometry is whatever the disk file was formatted with
+    struct stat st;
+    if (stat(diskname.c_str(), &st) == 0 && st.st_size >= BLOCK_SIZE)
+        this->no_blocks = st.st_size / BLOCK_SIZE;
+    this->disk_size = (uint64_t)no_blocks * BLOCK_SIZE;
+    if (this->backend == DISK_BACKEND_MMAP && !map_disk_file()) {
+        std::cerr << "WARNING: Can't map diskfile: " << diskname << ", falling back to stream I/O" << std::endl;
+        this->backend = DISK_BACKEND_STREAM;
+    }
+    // not every file system supports O_DIRECT (tmpfs doesn't)
+    if (this->backend == DISK_BACKEND_DIRECT && !open_disk_file(O_DIRECT)) {
+        std::cerr << "WARNING: Can't open diskfile: " << diskname << " with O_DIRECT, falling back to buffered pread/pwrite" << std::endl;
+        this->backend = DISK_BACKEND_PIO;
+    }
+    if (this->backend == DISK_BACKEND_PIO && !open_disk_file()) {
+        std::cerr << "WARNING: Can't open diskfile: " << diskname << " for pread/pwrite, falling back to stream I/O" << std::endl;
+        this->backend = DISK_BACKEND_STREAM;
+    }
+    scan_holes();
+    if (this->backend != DISK_BACKEND_STREAM)
+        return;
     // the disk is simulated as a binary file
-    diskfile.open(DISKNAME, std::ios::in | std::ios::out | std::ios::binary);
+    diskfile.open(diskname.c_str(), std::ios::in | std::ios::out | std::ios::binary);
     if (!diskfile.is_open()) {
-        std::cerr << "ERROR: Can't open diskfile: " << DISKNAME << ", exiting..."<< std::endl;
+        std::cerr << "ERROR: Can't open diskfile: " << diskname << ", exiting..."<< std::endl;
         exit(-1);
     }
 }
 
 Disk::~Disk()
 {
-    diskfile.close();
+    drain();
+    delete aio;
+    if (aio_fd != -1 && aio_fd != fd)
+        close(aio_fd);
+    sync();
+    if (map != nullptr)
+        munmap(map, disk_size);
+    if (fd != -1)
+        close(fd);
+    if (diskfile.is_open())
+        diskfile.close();
+}
+
+// waits for asynchronous requests still in flight, their blocks have to be
+// on disk before they are synced
+void
+Disk::drain()
+{
+    std::vector<aio_request> done;
+
+    zeroed.clear();
+    while (aio != nullptr && aio->get_in_flight() > 0 && complete(done, aio->get_in_flight()) >= 0)
+        done.clear();
+}
+
+int
+Disk::resize(unsigned no_blocks)
+{
+    int ret = 0;
+
+    if (no_blocks == 0)
+        return -1;
+    drain();
+    if (sync() != 0)
+        ret = -1;
+    if (map != nullptr) {
+        munmap(map, disk_size);
+        map = nullptr;
+    }
+    if (diskfile.is_open())
+        diskfile.close();
+    uint64_t size = (uint64_t)no_blocks * BLOCK_SIZE;
+    if (truncate(diskname.c_str(), size) == -1) {
+        std::cerr << "ERROR: Can't resize diskfile: " << diskname << " to " << size << " bytes" << std::endl;
+        ret = -1;
+    } else {
+        this->no_blocks = no_blocks;
+        this->disk_size = size;
+    }
+    scan_holes();
+    // the descriptor stays valid, only the mapping and the stream have to
+    // be set up again for the new size
+    if (backend == DISK_BACKEND_MMAP) {
+        void *addr = mmap(nullptr, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) {
+            std::cerr << "ERROR: Can't map diskfile: " << diskname << ", exiting..." << std::endl;
+            exit(-1);
+        }
+        map = (uint8_t*)addr;
+    } else if (backend == DISK_BACKEND_STREAM) {
+        diskfile.open(diskname.c_str(), std::ios::in | std::ios::out | std::ios::binary);
+        if (!diskfile.is_open()) {
+            std::cerr << "ERROR: Can't open diskfile: " << diskname << ", exiting..." << std::endl;
+            exit(-1);
+        }
+    }
+    return ret;
+}
+
+// finds the blocks of the disk file that hold no data, every block counts
+// as written when the file system can't tell
+void
+Disk::scan_holes()
+{
+    int scan_fd = fd != -1 ? fd : open(diskname.c_str(), O_RDONLY);
+    off_t data, hole = 0;
+
+    holes.assign(no_blocks, true);
+    if (scan_fd == -1) {
+        holes.assign(no_blocks, false);
+        return;
+    }
+    while ((data = lseek(scan_fd, hole, SEEK_DATA)) != -1) {
+        hole = lseek(scan_fd, data, SEEK_HOLE);
+        if (hole == -1)
+            hole = disk_size;
+        for (uint64_t b = data / BLOCK_SIZE; b < no_blocks && b * BLOCK_SIZE < (uint64_t)hole; b++)
+            holes[b] = false;
+    }
+    // ENXIO means there is no data past the offset
+    if (errno != ENXIO)
+        holes.assign(no_blocks, false);
+    if (scan_fd != fd)
+        close(scan_fd);
 }
 
 bool
@@ -31,6 +168,101 @@ Disk::disk_file_exists (const std::string& name) {
     return f.good();
 }
 
+// opens the disk file as a plain descriptor for pread/pwrite
+bool
+Disk::open_disk_file(int flags)
+{
+    struct stat st;
+
+    fd = open(diskname.c_str(), O_RDWR | flags);
+    if (fd == -1)
+        return false;
+    // the file must cover every block
+    if (fstat(fd, &st) == -1 || ((uint64_t)st.st_size < disk_size && ftruncate(fd, disk_size) == -1)) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+// maps the whole disk file into memory, blocks are then accessed directly
+bool
+Disk::map_disk_file()
+{
+    void *addr;
+
+    // touching the mapping past the end of the file raises SIGBUS, so the
+    // file is first grown to cover every block
+    if (!open_disk_file())
+        return false;
+    addr = mmap(nullptr, disk_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        close(fd);
+        fd = -1;
+        return false;
+    }
+    map = (uint8_t*)addr;
+    return true;
+}
+
+// pushes out or marks as dirty count blocks that were just written
+int
+Disk::written(unsigned block_no, unsigned count)
+{
+    for (unsigned i = 0; i < count; i++)
+        holes[block_no + i] = false;
+    if (write_mode == DISK_WRITE_THROUGH) {
+        if (map != nullptr)
+            return msync(map + (size_t)block_no * BLOCK_SIZE, (size_t)count * BLOCK_SIZE, MS_SYNC) == -1 ? -1 : 0;
+        if (fd != -1)
+            return fdatasync(fd) == -1 ? -1 : 0;
+        diskfile.flush();
+        return diskfile.good() ? 0 : -1;
+    }
+    for (unsigned i = 0; i < count; i++)
+        dirty.insert(block_no + i);
+    if (dirty.size() >= dirty_threshold)
+        return sync();
+    return 0;
+}
+
+// O_DIRECT only moves buffers aligned to POOL_ALIGNMENT, others are copied
+// through a buffer from the pool
+bool
+Disk::needs_bounce(const uint8_t *blk)
+{
+    return backend == DISK_BACKEND_DIRECT && !BlockPool::aligned(blk);
+}
+
+int
+Disk::pread_block(uint8_t *blk, off_t offset)
+{
+    uint8_t *buffer = needs_bounce(blk) ? pool.get() : blk;
+    if (buffer == nullptr)
+        return -1;
+    int ret = pread(fd, buffer, BLOCK_SIZE, offset) == BLOCK_SIZE ? 0 : -1;
+    if (buffer != blk) {
+        memcpy(blk, buffer, BLOCK_SIZE);
+        pool.put(buffer);
+    }
+    return ret;
+}
+
+int
+Disk::pwrite_block(uint8_t *blk, off_t offset)
+{
+    uint8_t *buffer = needs_bounce(blk) ? pool.get() : blk;
+    if (buffer == nullptr)
+        return -1;
+    if (buffer != blk)
+        memcpy(buffer, blk, BLOCK_SIZE);
+    int ret = pwrite(fd, buffer, BLOCK_SIZE, offset) == BLOCK_SIZE ? 0 : -1;
+    if (buffer != blk)
+        pool.put(buffer);
+    return ret;
+}
+
 // writes one block to the disk
 int
 Disk::write(unsigned block_no, uint8_t *blk)
@@ -42,11 +274,22 @@ Disk::write(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
-    diskfile.seekp(offset, std::ios_base::beg);
-    diskfile.write((char*)blk, BLOCK_SIZE);
-    diskfile.flush();
-    return 0;
+    StatsTimer timer;
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    if (map != nullptr) {
+        memcpy(map + offset, blk, BLOCK_SIZE);
+    } else if (fd != -1) {
+        if (pwrite_block(blk, offset) != 0)
+            return -1;
+    } else {
+        diskfile.seekp(offset, std::ios_base::beg);
+        diskfile.write((char*)blk, BLOCK_SIZE);
+    }
+    stats.writes.blocks++;
+    // the sync of a write-through disk is part of the write
+    int ret = written(block_no, 1);
+    stats.writes.latency.add(timer.elapsed_us());
+    return ret;
 }
 
 // reads one block from the disk
@@ -60,8 +303,437 @@ Disk::read(unsigned block_no, uint8_t *blk)
         std::cout << "Disk::write - ERROR: Invalid block number (" << block_no << ")\n";
         return -1;
     }
-    unsigned offset = block_no * BLOCK_SIZE;
-    diskfile.seekg(offset, std::ios_base::beg);
-    diskfile.read((char*)blk, BLOCK_SIZE);
-    return 0;
+    // holes are zero-filled without touching the file
+    if (holes[block_no]) {
+        memset(blk, 0, BLOCK_SIZE);
+        stats.zero_fills++;
+        return 0;
+    }
+    StatsTimer timer;
+    off_t offset = (off_t)block_no * BLOCK_SIZE;
+    int ret = 0;
+    if (map != nullptr) {
+        memcpy(blk, map + offset, BLOCK_SIZE);
+    } else if (fd != -1) {
+        ret = pread_block(blk, offset);
+    } else {
+        diskfile.seekg(offset, std::ios_base::beg);
+        diskfile.read((char*)blk, BLOCK_SIZE);
+    }
+    stats.reads.blocks++;
+    stats.reads.latency.add(timer.elapsed_us());
+    return ret;
+}
+
+// returns a pointer to the contents of one block without copying it when
+// the disk file is mapped
+const uint8_t *
+Disk::read_ptr(unsigned block_no, uint8_t *blk)
+{
+    if (DEBUG)
+        std::cout << "Disk::read_ptr(" << block_no << ")\n";
+    if (block_no >= no_blocks) {
+        std::cout << "Disk::read_ptr - ERROR: Invalid block number (" << block_no << ")\n";
+        return nullptr;
+    }
+    if (map != nullptr) {
+        stats.reads.blocks++;
+        stats.reads.latency.add(0);
+        return map + (size_t)block_no * BLOCK_SIZE;
+    }
+    if (read(block_no, blk) != 0)
+        return nullptr;
+    return blk;
+}
+
+// moves one run of adjacent blocks with a single call to the backend
+int
+Disk::transfer_run(std::vector<block_io*> &run, bool is_write)
+{
+    unsigned first = run[0]->block_no;
+    off_t offset = (off_t)first * BLOCK_SIZE;
+    unsigned i;
+
+    if (map != nullptr) {
+        for (i = 0; i < run.size(); i++) {
+            if (is_write)
+                memcpy(map + offset + i * BLOCK_SIZE, run[i]->blk, BLOCK_SIZE);
+            else
+                memcpy(run[i]->blk, map + offset + i * BLOCK_SIZE, BLOCK_SIZE);
+        }
+    } else if (fd != -1) {
+        std::vector<struct iovec> iov(run.size());
+        int ret = 0;
+        for (i = 0; i < run.size(); i++) {
+            uint8_t *buffer = needs_bounce(run[i]->blk) ? pool.get() : run[i]->blk;
+            if (buffer == nullptr)
+                ret = -1;
+            else if (buffer != run[i]->blk && is_write)
+                memcpy(buffer, run[i]->blk, BLOCK_SIZE);
+            iov[i].iov_base = buffer;
+            iov[i].iov_len = BLOCK_SIZE;
+        }
+        ssize_t expected = (ssize_t)run.size() * BLOCK_SIZE;
+        if (ret == 0 && is_write && pwritev(fd, iov.data(), iov.size(), offset) != expected)
+            ret = -1;
+        if (ret == 0 && !is_write && preadv(fd, iov.data(), iov.size(), offset) != expected)
+            ret = -1;
+        for (i = 0; i < run.size(); i++) {
+            if (iov[i].iov_base == nullptr || iov[i].iov_base == run[i]->blk)
+                continue;
+            if (ret == 0 && !is_write)
+                memcpy(run[i]->blk, iov[i].iov_base, BLOCK_SIZE);
+            pool.put((uint8_t*)iov[i].iov_base);
+        }
+        if (ret != 0)
+            return ret;
+    } else {
+        // one seek for the run, the blocks then follow each other
+        if (is_write)
+            diskfile.seekp(offset, std::ios_base::beg);
+        else
+            diskfile.seekg(offset, std::ios_base::beg);
+        for (i = 0; i < run.size(); i++) {
+            if (is_write)
+                diskfile.write((char*)run[i]->blk, BLOCK_SIZE);
+            else
+                diskfile.read((char*)run[i]->blk, BLOCK_SIZE);
+        }
+    }
+    return is_write ? written(first, run.size()) : 0;
+}
+
+// splits the blocks into runs of adjacent block numbers and moves each run
+// with one call to the backend
+int
+Disk::transfer_blocks(std::vector<block_io> &blocks, bool is_write)
+{
+    std::vector<block_io*> sorted, run;
+    io_stats &io = is_write ? stats.writes : stats.reads;
+    StatsTimer timer;
+    unsigned i;
+    int ret = 0;
+
+    for (i = 0; i < blocks.size(); i++) {
+        if (blocks[i].block_no >= no_blocks) {
+            std::cout << "Disk::" << (is_write ? "write" : "read") << "_blocks - ERROR: Invalid block number (" << blocks[i].block_no << ")\n";
+            return -1;
+        }
+        if (!is_write && holes[blocks[i].block_no]) {
+            memset(blocks[i].blk, 0, BLOCK_SIZE);
+            stats.zero_fills++;
+            continue;
+        }
+        sorted.push_back(&blocks[i]);
+    }
+    // stable, so the last write to a block repeated in the list still wins
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const block_io *a, const block_io *b) { return a->block_no < b->block_no; });
+    for (i = 0; i < sorted.size(); i++) {
+        if (!run.empty() && (sorted[i]->block_no != run.back()->block_no + 1 || run.size() == (unsigned)IOV_MAX)) {
+            if (transfer_run(run, is_write) != 0)
+                ret = -1;
+            run.clear();
+        }
+        run.push_back(sorted[i]);
+    }
+    if (!run.empty() && transfer_run(run, is_write) != 0)
+        ret = -1;
+    if (!sorted.empty()) {
+        io.blocks += sorted.size();
+        io.latency.add(timer.elapsed_us());
+    }
+    return ret;
+}
+
+// writes several blocks to the disk
+int
+Disk::write_blocks(std::vector<block_io> &blocks)
+{
+    if (DEBUG)
+        std::cout << "Disk::write_blocks(" << blocks.size() << ")\n";
+    return transfer_blocks(blocks, true);
+}
+
+// reads several blocks from the disk
+int
+Disk::read_blocks(std::vector<block_io> &blocks)
+{
+    if (DEBUG)
+        std::cout << "Disk::read_blocks(" << blocks.size() << ")\n";
+    return transfer_blocks(blocks, false);
+}
+
+// persists every dirty block, adjacent dirty blocks are synced together
+int
+Disk::sync()
+{
+    if (DEBUG)
+        std::cout << "Disk::sync(" << dirty.size() << " dirty)\n";
+    if (dirty.empty())
+        return 0;
+    StatsTimer timer;
+    int ret = 0;
+    stats.syncs.blocks += dirty.size();
+    if (map == nullptr) {
+        if (fd != -1) {
+            if (!dirty.empty() && fdatasync(fd) == -1)
+                ret = -1;
+        } else {
+            diskfile.flush();
+            if (!diskfile.good())
+                ret = -1;
+        }
+        dirty.clear();
+        stats.syncs.latency.add(timer.elapsed_us());
+        return ret;
+    }
+    std::set<unsigned>::iterator it = dirty.begin();
+    while (it != dirty.end()) {
+        unsigned first = *it, count = 1;
+        for (++it; it != dirty.end() && *it == first + count; ++it)
+            count++;
+        if (msync(map + (size_t)first * BLOCK_SIZE, (size_t)count * BLOCK_SIZE, MS_SYNC) == -1)
+            ret = -1;
+    }
+    dirty.clear();
+    stats.syncs.latency.add(timer.elapsed_us());
+    return ret;
+}
+
+int
+Disk::discard(std::vector<unsigned> &blocks)
+{
+    if (DEBUG)
+        std::cout << "Disk::discard(" << blocks.size() << ")\n";
+    std::vector<unsigned> sorted(blocks);
+    int punch_fd, ret = 0;
+    unsigned i, first, count;
+
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+    while (!sorted.empty() && sorted.back() >= no_blocks)
+        sorted.pop_back();
+    if (sorted.empty())
+        return 0;
+    // the stream has no descriptor of its own, and must not write the blocks
+    // back after they were punched
+    if (fd == -1)
+        diskfile.flush();
+    punch_fd = fd != -1 ? fd : open(diskname.c_str(), O_RDWR);
+    if (punch_fd == -1)
+        return -1;
+    StatsTimer timer;
+    for (i = 0; i < sorted.size(); i += count) {
+        first = sorted[i];
+        for (count = 1; i + count < sorted.size() && sorted[i + count] == first + count; count++)
+            ;
+        if (fallocate(punch_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)first * BLOCK_SIZE, (off_t)count * BLOCK_SIZE) == -1) {
+            ret = -1;
+            continue;
+        }
+        for (unsigned b = first; b < first + count; b++) {
+            holes[b] = true;
+            dirty.erase(b);
+        }
+    }
+    if (punch_fd != fd)
+        close(punch_fd);
+    stats.discards.blocks += sorted.size();
+    stats.discards.latency.add(timer.elapsed_us());
+    return ret;
+}
+
+int
+Disk::readahead(const std::vector<unsigned> &blocks)
+{
+    if (DEBUG)
+        std::cout << "Disk::readahead(" << blocks.size() << ")\n";
+    unsigned i, first, count, hinted = 0;
+    int ret = 0;
+
+    if (fd == -1 || backend == DISK_BACKEND_DIRECT)
+        return 0;
+    StatsTimer timer;
+    for (i = 0; i < blocks.size(); i += count) {
+        first = blocks[i];
+        for (count = 1; i + count < blocks.size() && blocks[i + count] == first + count; count++)
+            ;
+        if (first >= no_blocks || first + count > no_blocks)
+            continue;
+        // holes read as zeros without the file
+        if (count == 1 && holes[first])
+            continue;
+        if (map != nullptr) {
+            if (madvise(map + (size_t)first * BLOCK_SIZE, (size_t)count * BLOCK_SIZE, MADV_WILLNEED) == -1)
+                ret = -1;
+        } else if (posix_fadvise(fd, (off_t)first * BLOCK_SIZE, (off_t)count * BLOCK_SIZE, POSIX_FADV_WILLNEED) != 0) {
+            ret = -1;
+        }
+        hinted += count;
+    }
+    if (hinted > 0) {
+        stats.readaheads.blocks += hinted;
+        stats.readaheads.latency.add(timer.elapsed_us());
+    }
+    return ret;
+}
+
+void
+Disk::set_write_mode(const uint8_t &mode)
+{
+    if (mode == DISK_WRITE_THROUGH)
+        sync();
+    write_mode = mode;
+}
+
+void
+Disk::set_dirty_threshold(const unsigned &threshold)
+{
+    dirty_threshold = threshold > 0 ? threshold : 1;
+    if (dirty.size() >= dirty_threshold)
+        sync();
+}
+
+bool
+Disk::use_async()
+{
+    return async && backend != DISK_BACKEND_MMAP;
+}
+
+// sets up the asynchronous engine on first use
+bool
+Disk::start_async()
+{
+    if (aio != nullptr)
+        return true;
+    aio_fd = fd != -1 ? fd : open(diskname.c_str(), O_RDWR);
+    if (aio_fd == -1)
+        return false;
+    aio = AsyncIO::create(aio_fd, AIO_QUEUE_DEPTH, DISK_USE_URING);
+    if (DEBUG)
+        std::cout << "Disk::start_async(" << (aio->get_engine() == AIO_ENGINE_URING ? "io_uring" : "threads") << ")\n";
+    return true;
+}
+
+bool
+Disk::submit(unsigned block_no, uint8_t *blk, bool is_write)
+{
+    if (block_no >= no_blocks) {
+        std::cout << "Disk::submit - ERROR: Invalid block number (" << block_no << ")\n";
+        return false;
+    }
+    if (!is_write && holes[block_no]) {
+        aio_request request;
+        request.block_no = block_no;
+        request.blk = blk;
+        request.is_write = false;
+        request.result = 0;
+        memset(blk, 0, BLOCK_SIZE);
+        zeroed.push_back(request);
+        stats.zero_fills++;
+        return true;
+    }
+    if (is_write)
+        holes[block_no] = false;
+    if (!start_async())
+        return false;
+    // the requests bypass the stream's buffer, so it must not hold any
+    // block written before them
+    if (fd == -1)
+        diskfile.flush();
+    if (aio->full())
+        return false;
+    aio_request request;
+    request.block_no = block_no;
+    request.blk = needs_bounce(blk) ? pool.get() : blk;
+    request.is_write = is_write;
+    request.result = 0;
+    if (request.blk == nullptr)
+        return false;
+    if (request.blk != blk) {
+        if (is_write)
+            memcpy(request.blk, blk, BLOCK_SIZE);
+        bounced[request.blk] = blk;
+    }
+    if (aio->submit(request)) {
+        submitted[request.blk] = stats_clock::now();
+        return true;
+    }
+    if (request.blk != blk) {
+        bounced.erase(request.blk);
+        pool.put(request.blk);
+    }
+    return false;
+}
+
+bool
+Disk::submit_read(unsigned block_no, uint8_t *blk)
+{
+    if (DEBUG)
+        std::cout << "Disk::submit_read(" << block_no << ")\n";
+    return submit(block_no, blk, false);
+}
+
+bool
+Disk::submit_write(unsigned block_no, uint8_t *blk)
+{
+    if (DEBUG)
+        std::cout << "Disk::submit_write(" << block_no << ")\n";
+    return submit(block_no, blk, true);
+}
+
+int
+Disk::complete(std::vector<aio_request> &done, unsigned min)
+{
+    size_t first = done.size();
+    int count = zeroed.size();
+    done.insert(done.end(), zeroed.begin(), zeroed.end());
+    zeroed.clear();
+    if (aio == nullptr)
+        return count;
+    first = done.size();
+    int reaped = aio->complete(done, min > (unsigned)count ? min - count : 0);
+    if (reaped < 0)
+        return -1;
+    count += reaped;
+    // finished writes are dirty like any other written block, or synced
+    // before their latency is taken on a write-through disk
+    for (size_t i = first; i < done.size(); i++)
+        if (done[i].is_write && done[i].result == 0 && written(done[i].block_no, 1) != 0)
+            count = -1;
+    // every request is a call of its own, from submission to completion
+    for (size_t i = first; i < done.size(); i++) {
+        std::unordered_map<uint8_t*, stats_clock::time_point>::iterator it = submitted.find(done[i].blk);
+        if (it == submitted.end())
+            continue;
+        io_stats &io = done[i].is_write ? stats.writes : stats.reads;
+        io.blocks++;
+        io.latency.add(std::chrono::duration_cast<std::chrono::microseconds>(stats_clock::now() - it->second).count());
+        submitted.erase(it);
+    }
+    // requests that went through a pool buffer get the caller's back
+    for (size_t i = first; i < done.size(); i++) {
+        std::unordered_map<uint8_t*, uint8_t*>::iterator it = bounced.find(done[i].blk);
+        if (it == bounced.end())
+            continue;
+        if (!done[i].is_write && done[i].result == 0)
+            memcpy(it->second, it->first, BLOCK_SIZE);
+        pool.put(it->first);
+        done[i].blk = it->second;
+        bounced.erase(it);
+    }
+    return count;
+}
+
+unsigned
+Disk::get_in_flight()
+{
+    return zeroed.size() + (aio != nullptr ? aio->get_in_flight() : 0);
+}
+
+bool
+Disk::queue_full()
+{
+    return aio != nullptr && aio->full();
 }
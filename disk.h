@@ -1,29 +1,157 @@
 #include <iostream>
 #include <fstream>
 #include <stdint.h>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "aio.h"
+#include "pool.h"
+#include "stats.h"
 
 #ifndef __DISK_H__
 #define __DISK_H__
 
 #define DISKNAME "diskfile.bin"
 #define BLOCK_SIZE 4096
+// size of a newly created disk file, 8 MiB, format can change it later
+#define DISK_DEFAULT_BLOCKS 2048
 #define DEBUG false
 
+// how the disk file is accessed, chosen when the Disk is constructed
+#define DISK_BACKEND_STREAM 0x00
+#define DISK_BACKEND_MMAP 0x01
+#define DISK_BACKEND_PIO 0x02
+// pread/pwrite with O_DIRECT, blocks bypass the page cache
+#define DISK_BACKEND_DIRECT 0x03
+
+// write-through has every block on the disk when its write returns, the
+// default. write-back only tracks it as dirty until sync() or until
+// DISK_DIRTY_THRESHOLD is reached
+#define DISK_WRITE_THROUGH 0x00
+#define DISK_WRITE_BACK 0x01
+#define DISK_DIRTY_THRESHOLD 64
+
+// asynchronous requests go through io_uring when true and the kernel allows
+// it, otherwise through a pool of threads doing pread/pwrite
+#define DISK_USE_URING true
+
+// one block of a vectored read or write
+struct block_io {
+    unsigned block_no;  // block number on disk
+    uint8_t *blk;       // BLOCK_SIZE bytes to read into / write from
+};
+
+// what went through a Disk since it was created or the stats were reset
+struct disk_stats {
+    io_stats reads;
+    io_stats writes;
+    io_stats syncs;     // blocks are the dirty blocks that were synced
+    io_stats discards;
+    io_stats readaheads;    // blocks are the blocks the kernel was asked to prefetch
+    uint64_t zero_fills = 0;    // reads of holes that never touched the file
+};
+
 class Disk {
 private:
+    static uint8_t default_backend;
+    static uint8_t default_write_mode;
     std::fstream diskfile;
-    const unsigned no_blocks = 2048;
-    const unsigned disk_size = BLOCK_SIZE * no_blocks;
+    std::string diskname;
+    uint8_t backend;
+    int fd;         // descriptor of the disk file, -1 for the stream backend
+    uint8_t *map;   // the mapped disk file, nullptr unless the mmap backend
+    uint8_t write_mode;
+    unsigned dirty_threshold;
+    std::set<unsigned> dirty;   // blocks written but not yet synced
+    AsyncIO *aio;   // created on the first asynchronous request
+    int aio_fd;     // descriptor used by aio, fd when there is one
+    bool async;
+    BlockPool pool;     // aligned buffers for the direct backend
+    std::unordered_map<uint8_t*, uint8_t*> bounced;    // pool buffer -> caller's buffer, for requests in flight
+    std::vector<bool> holes;    // blocks known to read as zeros, never written or discarded
+    std::vector<aio_request> zeroed;    // reads of holes, done without going to the disk
+    std::unordered_map<uint8_t*, stats_clock::time_point> submitted;   // when requests in flight were submitted
+    disk_stats stats;
+    unsigned no_blocks;     // taken from the size of the disk file
+    uint64_t disk_size;
     bool disk_file_exists (const std::string& name);
+    void drain();
+    void scan_holes();
+    bool open_disk_file(int flags = 0);
+    bool map_disk_file();
+    int written(unsigned block_no, unsigned count);
+    bool needs_bounce(const uint8_t *blk);
+    int pread_block(uint8_t *blk, off_t offset);
+    int pwrite_block(uint8_t *blk, off_t offset);
+    int transfer_run(std::vector<block_io*> &run, bool is_write);
+    int transfer_blocks(std::vector<block_io> &blocks, bool is_write);
+    bool start_async();
+    bool submit(unsigned block_no, uint8_t *blk, bool is_write);
 public:
-    Disk();
+    Disk(const uint8_t &backend = get_default_backend(), const std::string &name = DISKNAME);
     ~Disk();
+    // the backend used when none is given, can be changed at startup
+    static uint8_t get_default_backend() { return default_backend; }
+    static void set_default_backend(const uint8_t &backend) { default_backend = backend; }
+    // the write mode of new disks, write-back has to be asked for
+    static void set_default_write_mode(const uint8_t &mode) { default_write_mode = mode; }
     unsigned get_no_blocks() { return no_blocks; }
-    unsigned get_disk_size() { return disk_size; }
+    uint64_t get_disk_size() { return disk_size; }
+    // grows or shrinks the disk file to no_blocks blocks, blocks past the
+    // new end are lost
+    int resize(unsigned no_blocks);
+    uint8_t get_backend() { return backend; }
+    uint8_t get_write_mode() { return write_mode; }
+    // switching to write-through syncs the blocks that are still dirty
+    void set_write_mode(const uint8_t &mode);
+    void set_dirty_threshold(const unsigned &threshold);
+    unsigned get_no_dirty() { return dirty.size(); }
     // writes one block to the disk
     int write(unsigned block_no, uint8_t *blk);
     // reads one block from the disk
     int read(unsigned block_no, uint8_t *blk);
+    // returns a pointer to the contents of one block, straight into the
+    // mapping when there is one, otherwise the block is read into blk.
+    // returns nullptr on an invalid block number
+    const uint8_t *read_ptr(unsigned block_no, uint8_t *blk);
+    // writes several blocks, runs of adjacent block numbers are written with
+    // one call to the backend (pwritev for pio)
+    int write_blocks(std::vector<block_io> &blocks);
+    // reads several blocks, runs of adjacent block numbers are read with one
+    // call to the backend (preadv for pio)
+    int read_blocks(std::vector<block_io> &blocks);
+    // persists every dirty block
+    int sync();
+    // releases the storage of blocks that are no longer used by punching
+    // holes in the disk file, adjacent blocks are released together. the
+    // blocks read as zeros afterwards
+    int discard(std::vector<unsigned> &blocks);
+    // asks the kernel to start reading blocks into the page cache in the
+    // background, adjacent blocks are hinted together. does nothing for the
+    // stream backend, which has no descriptor, and the direct backend,
+    // which bypasses the page cache
+    int readahead(const std::vector<unsigned> &blocks);
+    bool is_hole(unsigned block_no) { return block_no < no_blocks && holes[block_no]; }
+
+    disk_stats *get_stats() { return &stats; }
+    void reset_stats() { stats = disk_stats(); }
+
+    // whether blocks should be moved with asynchronous requests, never for
+    // the mmap backend where a block is a memcpy away
+    bool use_async();
+    void set_async(const bool &async) { this->async = async; }
+    // queues an asynchronous read or write of one block, returns false if
+    // the queue is full or the block number is invalid. blk must stay valid
+    // until the request is completed
+    bool submit_read(unsigned block_no, uint8_t *blk);
+    bool submit_write(unsigned block_no, uint8_t *blk);
+    // waits until at least min requests are done and appends them to done,
+    // returns how many were appended or -1 on error
+    int complete(std::vector<aio_request> &done, unsigned min = 1);
+    unsigned get_in_flight();
+    bool queue_full();
 };
 
 #endif // __DISK_H__
@@ -5,6 +5,7 @@
 #include <cstdio>
 #include <cstring>
 
+#include "codec.h"
 #include "constants.h"
 
 /* * * * * * * * * * * * * *
@@ -14,55 +15,12 @@
  * * * * * * * * * * * * * *
  */
 
-void extract_attr(fs_obj::dir_entry *attributes, uint8_t *block) {
-  int i, block_i;
-  uint32_t temp = 0;
-
-  for (i = 0; i < F_NAME_SIZE; i++) {
-    attributes->file_name[i] = block[block_i];
-    block_i++;
-  }
-
-  block_i += F_SIZE_SIZE - 1;
-  for (i = 0; i < F_SIZE_SIZE; i++) {
-    temp = (temp << 8) | block[block_i - i];
-  }
-
-  attributes->size = temp;
-
-  block_i += F_FIRST_BLOCK_SIZE - 1;
-  for (i = 0; i < F_FIRST_BLOCK_SIZE; i++) {
-    temp = (temp << 8) | block[block_i - i];
-  }
-
-  block_i++;
-  attributes->first_blk = temp;
-  attributes->type = block[++block_i];
-  attributes->access_rights = block[++block_i];
-}
+void extract_attr(fs_obj::dir_entry *attributes, uint8_t *block) { codec::decode_attr(*attributes, block); }
 
 void insert_attr(fs_obj::dir_entry *attributes, uint8_t *block) {
-  int block_i, i;
-
-  block_i = 0;
-
-  for (i = 0; i < F_NAME_SIZE; i++) {
-    block[block_i] = attributes->file_name[i];
-    block_i++;
-  }
-
-  for (i = 0; i < F_SIZE_SIZE; i++) {
-    block[block_i] = block[block_i] | (attributes->size >> (i * 8));
-    block_i++;
-  }
-
-  for (i = 0; i < F_FIRST_BLOCK_SIZE; i++) {
-    block[block_i] = block[block_i] | (attributes->first_blk >> (i * 8));
-    block_i++;
-  }
+  int i;
 
-  block[block_i++] = attributes->type;
-  block[block_i++] = attributes->access_rights;
+  codec::encode_attr(block, *attributes);
 
   for (i = 0; i < ENTRY_ATTRIBUTE_SIZE; i++) {
     printf("%d ", block[i]);
@@ -71,18 +29,23 @@ void insert_attr(fs_obj::dir_entry *attributes, uint8_t *block) {
   printf("\n");
 }
 
+// Writes the children as the only leaf of the directory's tree.
 void insert_content(std::vector<fs_obj::dir_child *> children, uint8_t *block) {
-  int block_i, i;
+  int block_i, count;
 
-  block_i = ENTRY_ATTRIBUTE_SIZE;
+  count = std::min<int>(children.size(), DIR_LEAF_CHILDREN);
+  codec::put_le32(block + ENTRY_ATTRIBUTE_SIZE + N_TYPE_OFFSET, NODE_LEAF);
+  codec::put_le32(block + ENTRY_ATTRIBUTE_SIZE + N_COUNT_OFFSET, count);
+  codec::put_le32(block + ENTRY_ATTRIBUTE_SIZE + N_LINK_OFFSET, 0);
+
+  block_i = ENTRY_ATTRIBUTE_SIZE + DIR_NODE_HEADER_SIZE;
 
   for (fs_obj::dir_child *child : children) {
-    for (char letter : child->file_name) {
-      block[block_i++] = letter;
-    }
+    if (count-- == 0) break;
 
-    block[block_i++] = child->first_blk | 0x00;
-    block[block_i++] = (child->first_blk >> 8) | 0x00;
+    codec::encode_child(block + block_i, child->file_name, child->first_blk);
+    codec::bloom_add(block + ENTRY_ATTRIBUTE_SIZE + N_BLOOM_OFFSET, codec::name_hash(child->file_name));
+    block_i += DIR_CHILD_SIZE;
 
     // children.erase(std::remove(children.begin(), children.end(), child));  // WARNING: no idea if works.
   }
@@ -110,84 +73,52 @@ void update_parent(FS *fs, fs_obj::dir_entry *attributes, fs_obj::directory_t *p
  * * * * * * * * * * * * * *
  */
 
-void fs_obj::get_directory(FS *fs, fs_obj::directory_t *dir, const uint16_t &blk_index) {
+void fs_obj::get_directory(FS *fs, fs_obj::directory_t *dir, const uint32_t &blk_index) {
   uint8_t block[ENTRY_SIZE] = {0};
-  uint32_t temp = 0;
-  int i, current_i;
+  int i;
 
-  Disk *disk = fs->get_disk();
-  int16_t *fat = fs->get_fat();
+  BlockCache *cache = fs->get_cache();
+  std::vector<::dir_child> children;
 
-  disk->read(blk_index, block);
+  cache->read(blk_index, block);
   // Extract directory attributes
   extract_attr(&dir->attributes, block);
   // TODO: handle error
   if (dir->attributes.type != 1) {
     return;
   }
-  // Extract directory content
-  int16_t fat_index = dir->attributes.first_blk;
-  int internal_i = 0;
+  // Extract directory content, the FS walks its tree
   fs_obj::dir_child *temp_child;
-  int dir_child_size = sizeof(fs_obj::dir_child);
-  char file_name[56];
-
-  do {
-    if (fat_index != dir->attributes.first_blk) {
-      disk->read(fat_index, block);
-    }
-
-    // FIXME: for loop wont work
-    for (i = ENTRY_ATTRIBUTE_SIZE; i < (dir->attributes.size + ENTRY_ATTRIBUTE_SIZE); i++) {
-      if (internal_i < 56)
-        file_name[internal_i] = block[i];
-      else if (internal_i == 56)
-        temp = (temp << 8) | block[i + 1];
-      else
-        temp = (temp << 8) | block[i - 1];
-
-      internal_i++;
-
-      if (internal_i == dir_child_size) {
-        temp_child = new dir_child;
 
-        strncpy(temp_child->file_name, file_name, 56);
-        temp_child->first_blk = temp;
-        temp = 0;
+  fs->dir_children(blk_index, children);
 
-        dir->children.push_back(temp_child);
-
-        internal_i = 0;
-      }
-    }
-
-    fat_index = fat[fat_index];
-  } while (fat_index != -1);
+  for (i = 0; i < (int)children.size(); i++) {
+    temp_child = new dir_child;
+    memcpy(temp_child->file_name, children[i].file_name, F_NAME_SIZE);
+    temp_child->first_blk = children[i].index;
+    dir->children.push_back(temp_child);
+  }
 }
 
 void fs_obj::get_directory(FS *fs, directory_t *dir, directory_t *parent_dir, const char *name) {
-  int16_t child_index;
+  int child_index;
 
-  for (fs_obj::dir_child *child : parent_dir->children) {
-    if (strcmp(name, child->file_name) == 0) {
-      child_index = child->first_blk;
-      break;
-    }
-  }
+  // Found by the parent's hashed index.
+  if ((child_index = fs->lookup(parent_dir->attributes.first_blk, name)) == -1) return;
 
   fs_obj::get_directory(fs, dir, child_index);
   dir->attributes.parent_blk = parent_dir->attributes.first_blk;
 }
 
-void fs_obj::get_file(FS *fs, file_t *file, const uint16_t &blk_index) {
+void fs_obj::get_file(FS *fs, file_t *file, const uint32_t &blk_index) {
   uint8_t block[ENTRY_SIZE] = {0};
-  int16_t fat_index;
+  int32_t fat_index;
   int i;
 
-  Disk *disk = fs->get_disk();
-  int16_t *fat = fs->get_fat();
+  BlockCache *cache = fs->get_cache();
+  int32_t *fat = fs->get_fat();
 
-  disk->read(blk_index, block);
+  cache->read(blk_index, block);
 
   extract_attr(&file->attributes, block);
 
@@ -202,14 +133,9 @@ void fs_obj::get_file(FS *fs, file_t *file, const uint16_t &blk_index) {
 }
 
 void fs_obj::get_file(FS *fs, file_t *file, directory_t *parent_dir, const char name[56]) {
-  int16_t child_index;
+  int child_index;
 
-  for (fs_obj::dir_child *child : parent_dir->children) {
-    if (strcmp(name, child->file_name) == 0) {
-      child_index = child->first_blk;
-      break;
-    }
-  }
+  if ((child_index = fs->lookup(parent_dir->attributes.first_blk, name)) == -1) return;
 
   fs_obj::get_file(fs, file, child_index);
   file->attributes.parent_blk = parent_dir->attributes.first_blk;
@@ -296,12 +222,12 @@ void fs_obj::followPath(FS *fs, directory_t *searched_dir, const std::string &pa
 void fs_obj::create_dir(FS *fs, directory_t *dir, directory_t *parent) {
   uint8_t block[ENTRY_SIZE] = {0};
   int i, block_i;
-  Disk *disk = fs->get_disk();
+  BlockCache *cache = fs->get_cache();
 
   insert_attr(&dir->attributes, block);
   insert_content(dir->children, block);
 
-  disk->write(dir->attributes.first_blk, block);
+  cache->write(dir->attributes.first_blk, block);
 
   if (parent != nullptr) {
     update_parent(fs, &dir->attributes, parent);
@@ -311,7 +237,7 @@ void fs_obj::create_dir(FS *fs, directory_t *dir, directory_t *parent) {
 void fs_obj::create_file(FS *fs, file_t *file, directory_t *parent) {
   uint8_t block[ENTRY_SIZE] = {0};
   int i, block_i;
-  Disk *disk = fs->get_disk();
+  BlockCache *cache = fs->get_cache();
 
   insert_attr(&file->attributes, block);
 
@@ -321,7 +247,7 @@ void fs_obj::create_file(FS *fs, file_t *file, directory_t *parent) {
     block_i++;
   }
 
-  disk->write(file->attributes.first_blk, block);
+  cache->write(file->attributes.first_blk, block);
 
   update_parent(fs, &file->attributes, parent);
 }
@@ -11,14 +11,14 @@ namespace fs_obj {
 struct dir_entry {
   char file_name[56] = {0};   // Name of entry
   uint32_t size = 0;          // Content size
-  uint16_t first_blk = 0;     // First block  index
-  uint16_t parent_blk = 0;    // Parent disk index
+  uint32_t first_blk = 0;     // First block  index
+  uint32_t parent_blk = 0;    // Parent disk index
   uint8_t type = 0;           // File or directory
   uint8_t access_rights = 0;  // Who can access
 };
 struct dir_child {
   char file_name[56] = {0};  // Name of child
-  uint16_t first_blk = 0;    // first block on disk
+  uint32_t first_blk = 0;    // first block on disk
 };
 struct directory_t {
   dir_entry attributes;               // Directory attributes
@@ -32,9 +32,9 @@ struct file_t {
 /* Get a directory from disk with fat index
  * @param FS *fs filesystem
  * @param directory_t *dir directory obj
- * @param const uint16_t &blk_index fat index
+ * @param const uint32_t &blk_index fat index
  */
-void get_directory(FS *fs, directory_t *dir, const uint16_t &blk_index);
+void get_directory(FS *fs, directory_t *dir, const uint32_t &blk_index);
 /* Get a directory from disk with parent
  * @param FS *fs filesystem
  * @param directory_t *dir directory obj
@@ -46,9 +46,9 @@ void get_directory(FS *fs, directory_t *dir, directory_t *parent_dir, const char
 /* Get a file from disk with fat index
  * @param FS *fs filesystem
  * @param file_t *file the loaded file
- * @param const uint16_t &blk_index fat index
+ * @param const uint32_t &blk_index fat index
  * */
-void get_file(FS *fs, file_t *file, const uint16_t &blk_index);
+void get_file(FS *fs, file_t *file, const uint32_t &blk_index);
 /* Get file from disk with parent
  * @param FS *fs filesystem
  * @param file_t *file the loaded file
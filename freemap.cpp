@@ -0,0 +1,191 @@
+#include "freemap.h"
+
+#include <iterator>
+
+FreeMap::FreeMap() { reset(0); }
+
+void FreeMap::reset(const unsigned &no_blocks) {
+  this->no_blocks = no_blocks;
+  this->no_free = 0;
+  this->first_word = 0;
+  this->words.assign((no_blocks + 63) / 64, 0);
+  this->extents.clear();
+  this->by_length.clear();
+}
+
+void FreeMap::add_extent(const unsigned &start, const unsigned &length) {
+  this->extents[start] = length;
+  this->by_length.insert(std::make_pair(length, start));
+}
+
+void FreeMap::remove_extent(const unsigned &start, const unsigned &length) {
+  // start and length may point into the extent's own node, so it goes last.
+  this->by_length.erase(std::make_pair(length, start));
+  this->extents.erase(start);
+}
+
+void FreeMap::mark(const unsigned &block, const bool &free) {
+  uint64_t bit;
+
+  if (block >= this->no_blocks) return;
+
+  bit = 1ULL << (block % 64);
+
+  if (free == ((this->words[block / 64] & bit) != 0)) return;
+
+  std::map<unsigned, unsigned>::iterator next, prev;
+  unsigned start, length;
+
+  if (free) {
+    this->words[block / 64] |= bit;
+    this->no_free++;
+
+    if (block / 64 < this->first_word) this->first_word = block / 64;
+
+    // Merge with the extents right before and after the block.
+    start = block;
+    length = 1;
+    next = this->extents.upper_bound(block);
+
+    if (next != this->extents.end() && next->first == block + 1) {
+      length += next->second;
+      remove_extent(next->first, next->second);
+    }
+
+    next = this->extents.upper_bound(block);
+
+    if (next != this->extents.begin()) {
+      prev = std::prev(next);
+
+      if (prev->first + prev->second == block) {
+        start = prev->first;
+        length += prev->second;
+        remove_extent(prev->first, prev->second);
+      }
+    }
+
+    add_extent(start, length);
+  } else {
+    this->words[block / 64] &= ~bit;
+    this->no_free--;
+
+    // Split the extent holding the block.
+    prev = std::prev(this->extents.upper_bound(block));
+    start = prev->first;
+    length = prev->second;
+
+    remove_extent(start, length);
+
+    if (block > start) add_extent(start, block - start);
+    if (block + 1 < start + length) add_extent(block + 1, start + length - block - 1);
+  }
+}
+
+int FreeMap::find_free(const unsigned &from) {
+  unsigned word;
+  uint64_t bits;
+
+  if (from >= this->no_blocks) return -1;
+
+  // Words that are completely used are skipped for good, the next search
+  // starts after them.
+  while (this->first_word < this->words.size() && this->words[this->first_word] == 0) this->first_word++;
+
+  word = from / 64 > this->first_word ? from / 64 : this->first_word;
+
+  for (; word < this->words.size(); word++) {
+    bits = this->words[word];
+
+    // Bits below from don't count in its own word.
+    if (word == from / 64) bits &= ~0ULL << (from % 64);
+
+    if (bits != 0) return word * 64 + __builtin_ctzll(bits);
+  }
+
+  return -1;
+}
+
+unsigned FreeMap::run_length(const unsigned &block, const unsigned &max) {
+  unsigned length;
+  uint64_t bits;
+
+  length = 0;
+
+  while (length < max && block + length < this->no_blocks) {
+    // A whole word at a time when it's aligned.
+    if ((block + length) % 64 == 0 && this->words[(block + length) / 64] == ~0ULL) {
+      length += 64;
+      continue;
+    }
+
+    bits = this->words[(block + length) / 64] >> ((block + length) % 64);
+
+    if ((bits & 1) == 0) break;
+
+    length++;
+  }
+
+  if (length > max) length = max;
+  if (block + length > this->no_blocks) length = this->no_blocks - block;
+
+  return length;
+}
+
+int FreeMap::find_run(const unsigned &count, const unsigned &from) {
+  int block;
+  unsigned length;
+
+  if (count == 0) return -1;
+
+  for (block = find_free(from); block != -1; block = find_free(block + length)) {
+    length = run_length(block, count);
+
+    if (length >= count) return block;
+  }
+
+  return -1;
+}
+
+int FreeMap::find_best_fit(const unsigned &count) {
+  std::set<std::pair<unsigned, unsigned> >::iterator it;
+
+  if (count == 0 || (it = this->by_length.lower_bound(std::make_pair(count, 0U))) == this->by_length.end()) return -1;
+
+  return it->second;
+}
+
+int FreeMap::find_next_fit(const unsigned &count, const unsigned &from) {
+  std::map<unsigned, unsigned>::iterator it;
+  unsigned pass;
+
+  if (count == 0 || this->extents.empty()) return -1;
+
+  // The extent holding from, if any, is only usable from from on.
+  it = this->extents.upper_bound(from);
+
+  if (it != this->extents.begin()) {
+    it = std::prev(it);
+
+    if (it->first + it->second >= from + count) return from;
+
+    it++;
+  }
+
+  // Up to the end of the disk, then from its start.
+  for (pass = 0; pass < 2; pass++) {
+    for (; it != this->extents.end() && (pass == 0 || it->first < from); it++)
+      if (it->second >= count) return it->first;
+
+    it = this->extents.begin();
+  }
+
+  return -1;
+}
+
+int FreeMap::find_longest(unsigned &length) {
+  if (this->by_length.empty()) return -1;
+
+  length = this->by_length.rbegin()->first;
+
+  return this->by_length.rbegin()->second;
+}
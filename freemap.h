@@ -0,0 +1,63 @@
+#include <cstdint>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#ifndef __FREEMAP_H__
+#define __FREEMAP_H__
+
+// Bitmap of the free blocks on the disk, one bit per block, set when the
+// block is free. Kept next to the FAT so allocation doesn't scan it. The
+// runs of free blocks (extents) are indexed by start and by length as well.
+class FreeMap {
+ private:
+  std::vector<uint64_t> words;
+  unsigned no_blocks;
+  unsigned no_free;
+  // No word below this one has a free block
+  unsigned first_word;
+  // start -> length of every free extent
+  std::map<unsigned, unsigned> extents;
+  // (length, start) of every free extent, for best-fit
+  std::set<std::pair<unsigned, unsigned> > by_length;
+
+  void mark(const unsigned &block, const bool &free);
+  void add_extent(const unsigned &start, const unsigned &length);
+  void remove_extent(const unsigned &start, const unsigned &length);
+
+ public:
+  FreeMap();
+
+  // every block starts out as used
+  void reset(const unsigned &no_blocks);
+
+  void set_free(const unsigned &block) { mark(block, true); }
+  void set_used(const unsigned &block) { mark(block, false); }
+  bool is_free(const unsigned &block) { return block < no_blocks && (words[block / 64] >> (block % 64)) & 1; }
+
+  // returns the first free block at or after from, -1 if there is none
+  int find_free(const unsigned &from = 0);
+  // returns the first block of the first run of count free blocks at or
+  // after from, -1 if there is none
+  int find_run(const unsigned &count, const unsigned &from = 0);
+  // returns how many free blocks follow each other from block on
+  unsigned run_length(const unsigned &block, const unsigned &max);
+
+  // returns the start of the shortest free extent of at least count blocks,
+  // -1 if there is none
+  int find_best_fit(const unsigned &count);
+  // returns the start of the first free extent of at least count blocks at or
+  // after from, wrapping around to the start of the disk, -1 if there is none.
+  // An extent that starts before from but reaches past it counts from from.
+  int find_next_fit(const unsigned &count, const unsigned &from);
+  // returns the start of the longest free extent, its length in length, -1 if
+  // no block is free
+  int find_longest(unsigned &length);
+  unsigned get_no_extents() { return extents.size(); }
+
+  unsigned get_no_free() { return no_free; }
+  unsigned get_no_blocks() { return no_blocks; }
+};
+
+#endif  // __FREEMAP_H__
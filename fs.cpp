@@ -4,170 +4,313 @@
 #include <string.h>
 #include <strings.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <cstdio>
+#include <functional>
 #include <iostream>
+#include <thread>
 #include <vector>
 
+#include "codec.h"
 #include "entry.h"
 
-// Loads the fat table.
+static const char *op_names[FS_OP_COUNT] = {"create", "cat", "ls", "cp", "rm", "mkdir", "cd", "append", "defrag", "fsck"};
+
+uint8_t FS::mount_check = FSCK_NONE;
+
+// Number of blocks the FAT needs to cover a disk of no_blocks blocks.
+unsigned FS::calc_fat_blocks(const unsigned &no_blocks) { return ((uint64_t)no_blocks * FAT_ENTRY_SIZE + BLOCK_SIZE - 1) / BLOCK_SIZE; }
+
+// Loads the fat table, it's stored little-endian in the blocks following
+// FAT_BLOCK. When the file system was unmounted cleanly the free block count
+// comes from the superblock and each group's part of the FAT is only read
+// when the group is first used. Otherwise the whole FAT is read and the free
+// blocks are counted in it.
 void FS::load_fat() {
-  uint8_t block[BLOCK_SIZE];
-  uint16_t cell;
+  unsigned no_blocks;
+  superblock super;
+
+  no_blocks = this->disk.get_no_blocks();
+  this->fat_blocks = calc_fat_blocks(no_blocks);
+  this->fat.assign(no_blocks, FAT_FREE);
+  this->has_superblock = read_superblock(super) == 0;
+
+  if (this->has_superblock && (super.version != SB_VERSION || super.block_size != BLOCK_SIZE || super.no_blocks != no_blocks ||
+                               super.fat_first != FAT_BLOCK || super.fat_blocks != this->fat_blocks)) {
+    printf("The superblock doesn't match the disk, format it.\n");
+    this->has_superblock = false;
+  }
+
+  build_free_map();
+
+  if (this->has_superblock && super.state == SB_STATE_CLEAN && super.free_blocks <= no_blocks) {
+    this->no_free = super.free_blocks;
+  } else {
+    if (this->has_superblock) printf("The file system wasn't unmounted cleanly, counting free blocks.\n");
 
-  int index, fat_index;
-  fat_index = 0;
+    load_whole_fat();
+    this->no_free = std::count(this->fat.begin(), this->fat.end(), FAT_FREE);
+  }
+
+  // Dirty until it's unmounted, a crash leaves it that way.
+  if (this->has_superblock) write_superblock(SB_STATE_DIRTY);
+
+  this->chains.clear();
+  this->chain_lru.clear();
+  this->chain_tails.clear();
+  this->dir_indexes.clear();
+  this->dir_index_lru.clear();
+  this->dentries.clear();
+  this->dentry_lru.clear();
+  this->dentry_blocks.clear();
+  this->dentry_parents.clear();
+  this->fat_dirty.clear();
+  this->fat_pending = 0;
+}
+
+// Sets up the allocation groups, their bitmaps are built when they're first
+// used.
+void FS::build_free_map() {
+  unsigned first;
+  alloc_group *group;
 
-  this->disk.read(FAT_BLOCK, block);
+  this->groups.clear();
+  this->next_group = 0;
 
-  for (index = 0; index < BLOCK_SIZE; index += 2) {
-    cell = block[index + 1];
-    cell = (cell << 8) | block[index];
+  for (first = 0; first < this->fat.size(); first += ALLOC_GROUP_BLOCKS) {
+    group = new alloc_group;
+    group->first = first;
+    group->length = std::min<size_t>(ALLOC_GROUP_BLOCKS, this->fat.size() - first);
+    group->filled = false;
+    group->loaded = false;
+    group->cursor = 0;
 
-    fat[fat_index] = cell;
-    fat_index++;
+    this->groups.push_back(std::unique_ptr<alloc_group>(group));
   }
 }
 
-// Takes the current state of the fat table and writes it to disk
-void FS::update_fat() {
-  uint8_t block[BLOCK_SIZE];
-  uint8_t l_cell, r_cell;
-  uint16_t buffer;
+// Builds the free space bitmap of a group from the FAT if it wasn't yet. The
+// group's lock is held.
+void FS::fill_group(alloc_group &group) {
+  unsigned index;
+
+  if (group.filled) return;
+
+  load_fat_group(group);
+  group.free_map.reset(group.length);
 
-  int index_f, index_b;
-  index_b = 0;
+  for (index = 0; index < group.length; index++)
+    if (this->fat[group.first + index] == FAT_FREE) group.free_map.set_free(index);
 
-  for (index_f = 0; index_f < BLOCK_SIZE / 2; index_f++) {
-    buffer = this->fat[index_f];
+  group.filled = true;
+}
+
+// Reads the part of the FAT that covers a group with one vectored read.
+void FS::load_fat_group(alloc_group &group) {
+  std::vector<uint8_t> blocks;
+  std::vector<block_io> io;
+  unsigned first, count, index;
 
-    r_cell = buffer & 0xff;
+  if (group.loaded) return;
 
-    buffer = buffer >> 8;
-    l_cell = buffer & 0xff;
+  first = FAT_BLOCK + group.first / FAT_ENTRIES_PER_BLOCK;
+  count = (group.length + FAT_ENTRIES_PER_BLOCK - 1) / FAT_ENTRIES_PER_BLOCK;
+  blocks.resize(count * BLOCK_SIZE);
+  io.resize(count);
 
-    block[index_b++] = l_cell;
-    block[index_b++] = r_cell;
+  for (index = 0; index < count; index++) {
+    io[index].block_no = first + index;
+    io[index].blk = &blocks[index * BLOCK_SIZE];
   }
 
-  this->disk.write(FAT_BLOCK, block);
-  this->load_fat();
+  this->cache.read_blocks(io);
+
+  codec::decode_le32(&this->fat[group.first], blocks.data(), group.length);
+  group.loaded = true;
 }
 
-void FS::empty_array(uint8_t *arr, const int &size) {
-  int index;
+// Reads every part of the FAT that wasn't yet, for whatever walks all of it.
+void FS::load_whole_fat() {
+  for (std::unique_ptr<alloc_group> &group : this->groups) load_fat_group(*group);
+}
 
-  for (index = 0; index < size; index++) arr[index] = 0x00;
+// Reads the superblock, returns -1 if the disk doesn't have one.
+int FS::read_superblock(superblock &super) {
+  const uint8_t *block;
+
+  if ((block = this->cache.read_ptr(SUPER_BLOCK)) == nullptr || codec::get_le32(block + SB_MAGIC_OFFSET) != SB_MAGIC) return -1;
+
+  super.magic = SB_MAGIC;
+  super.version = codec::get_le32(block + SB_VERSION_OFFSET);
+  super.block_size = codec::get_le32(block + SB_BLOCK_SIZE_OFFSET);
+  super.no_blocks = codec::get_le32(block + SB_NO_BLOCKS_OFFSET);
+  super.fat_first = codec::get_le32(block + SB_FAT_FIRST_OFFSET);
+  super.fat_blocks = codec::get_le32(block + SB_FAT_BLOCKS_OFFSET);
+  super.free_blocks = codec::get_le32(block + SB_FREE_BLOCKS_OFFSET);
+  super.state = codec::get_le32(block + SB_STATE_OFFSET);
+
+  return 0;
 }
 
-void FS::fill_attr_array(uint8_t *attr, const int &size, dir_entry *entry) {
-  int index, current_size, next_size, size_size, first_blk_size;
-  uint8_t cell;
-  uint32_t buffer;
+// Writes the superblock with the current geometry and free block count.
+int FS::write_superblock(const uint32_t &state) {
+  uint8_t block[BLOCK_SIZE] = {0};
 
-  current_size = 0;
-  next_size = 56;
-  size_size = 4;
-  first_blk_size = 2;
+  codec::put_le32(block + SB_MAGIC_OFFSET, SB_MAGIC);
+  codec::put_le32(block + SB_VERSION_OFFSET, SB_VERSION);
+  codec::put_le32(block + SB_BLOCK_SIZE_OFFSET, BLOCK_SIZE);
+  codec::put_le32(block + SB_NO_BLOCKS_OFFSET, this->fat.size());
+  codec::put_le32(block + SB_FAT_FIRST_OFFSET, FAT_BLOCK);
+  codec::put_le32(block + SB_FAT_BLOCKS_OFFSET, this->fat_blocks);
+  codec::put_le32(block + SB_FREE_BLOCKS_OFFSET, this->no_free);
+  codec::put_le32(block + SB_STATE_OFFSET, state);
 
-  for (index = current_size; index < next_size; index++) {
-    cell = entry->file_name[index];
-    attr[index] = cell;
-  }
+  return this->cache.write(SUPER_BLOCK, block);
+}
 
-  current_size = next_size;
-  next_size += size_size;
+// Changes one entry of the FAT, keeping the free block count and the free
+// space bitmap in step. The entry and the dirty blocks change under the FAT
+// lock, the bitmap under its group's lock, the two aren't held together.
+// The caches dropped first aren't locked.
+void FS::set_fat(const unsigned &index, const int32_t &value) {
+  if (!this->chains.empty()) invalidate_chain(index);
 
-  for (index = current_size; index < next_size; index++) {
-    buffer = entry->size >> (8 * (index - current_size));
-    cell = buffer & 0xff;
-    attr[index] = cell;
+  if (value == FAT_FREE && !this->dir_indexes.empty()) drop_dir_index(index);
+
+  if (value == FAT_FREE && !this->dentries.empty()) {
+    drop_dentry(index);
+    drop_dir_dentries(index);
   }
 
-  current_size = next_size;
-  next_size += first_blk_size;
+  // Read before the lock is taken, in case its part of the FAT isn't yet.
+  fat_entry(index);
+
+  {
+    std::lock_guard<std::mutex> guard(this->fat_lock);
 
-  for (index = current_size; index < next_size; index++) {
-    buffer = entry->first_blk >> (8 * (index - current_size));
-    cell = buffer & 0xff;
-    attr[index] = cell;
+    if (this->fat[index] == FAT_FREE && value != FAT_FREE)
+      this->no_free--;
+    else if (this->fat[index] != FAT_FREE && value == FAT_FREE)
+      this->no_free++;
+
+    this->fat[index] = value;
+    this->fat_dirty.insert(index / FAT_ENTRIES_PER_BLOCK);
   }
 
-  current_size = next_size;
+  alloc_group &group = group_of(index);
+  std::lock_guard<std::mutex> guard(group.lock);
+
+  // A group that isn't filled reads the FAT when it is.
+  if (!group.filled) return;
 
-  attr[current_size++] = entry->type;
-  attr[current_size++] = entry->access_rights;
+  if (value == FAT_FREE)
+    group.free_map.set_free(index - group.first);
+  else
+    group.free_map.set_used(index - group.first);
 }
 
-dir_entry *FS::follow_path(const path_obj *path) {
-  std::vector<dir_child *> children;
-  bool dir_exists, entry_found;
-  int index, path_index;
-  dir_entry *dir;
+// Called when an operation is done changing the FAT. On a write-back disk
+// the changed blocks of the FAT are written every fat_flush_interval
+// operations, so several operations can share one write. On a write-through
+// disk they're written every time, with the rest of the operation.
+void FS::update_fat() {
+  if (++this->fat_pending >= this->fat_flush_interval || this->disk.get_write_mode() == DISK_WRITE_THROUGH) flush_fat();
+}
+
+// Writes the FAT blocks with changed entries to disk.
+int FS::flush_fat() {
+  std::vector<uint8_t> blocks;
+  std::vector<block_io> io;
+  unsigned first, last;
+  uint8_t *block;
+
+  this->fat_pending = 0;
+
+  {
+    std::lock_guard<std::mutex> guard(this->fat_lock);
+
+    if (this->fat_dirty.empty()) return 0;
+
+    blocks.resize(this->fat_dirty.size() * BLOCK_SIZE, 0);
+
+    for (unsigned dirty : this->fat_dirty) {
+      block = &blocks[io.size() * BLOCK_SIZE];
+      first = dirty * FAT_ENTRIES_PER_BLOCK;
+      last = std::min<size_t>(first + FAT_ENTRIES_PER_BLOCK, this->fat.size());
+
+      codec::encode_le32(block, &this->fat[first], last - first);
 
-  dir_exists = true;
-  entry_found = false;
+      io.push_back(block_io());
+      io.back().block_no = FAT_BLOCK + dirty;
+      io.back().blk = block;
+    }
+
+    this->fat_dirty.clear();
+  }
+
+  return this->cache.write_blocks(io);
+}
+
+void FS::empty_array(uint8_t *arr, const int &size) {
+  int index;
 
-  path_index = 0;
+  for (index = 0; index < size; index++) arr[index] = 0x00;
+}
+
+void FS::fill_attr_array(uint8_t *attr, const int &size, dir_entry *entry) { codec::encode_attr(attr, *entry); }
+
+dir_entry *FS::follow_path(const path_obj *path) {
+  const dentry *dir;
+  unsigned block;
 
   if (path->start == START_ROOT)
-    dir = read_block_attr(ROOT_BLOCK);
+    block = ROOT_BLOCK;
   else if (path->start == START_WDIR && this->working_dir != nullptr)
-    dir = this->working_dir;
+    block = this->working_dir->first_blk;
   else
     return nullptr;
 
-  if (path->dirs.size() == 0) return dir;
+  if (path->dirs.size() == 0) return path->start == START_ROOT ? read_block_attr(ROOT_BLOCK) : this->working_dir;
 
-  while (dir_exists && !entry_found) {
-    children = read_cont_dir(dir);
-    dir_exists = false;
+  // Every step after the first time comes from the dentry cache.
+  for (const std::string &name : path->dirs) {
+    if ((dir = resolve(block, name)) == nullptr || dir->attr.type != TYPE_DIR) return nullptr;
 
-    for (index = 0; index < children.size() && !dir_exists; index++) {
-      if (strcmp(children[index]->file_name, path->dirs[path_index].c_str()) == 0 && path_index == path->dirs.size()) {
-        dir = read_block_attr(children[index]->index);
-        dir_exists = true;
-        entry_found = true;
-      } else if (strcmp(children[index]->file_name, path->dirs[path_index].c_str()) == 0) {
-        dir = read_block_attr(children[index]->index);
-        dir_exists = true;
-      }
-    }
+    block = dir->block;
   }
 
-  if (!dir_exists) dir = nullptr;
-
-  return dir;
+  return new dir_entry(dir->attr);
 }
 
 dir_entry *FS::get_child(const dir_entry *parent, const std::string &name) {
-  std::vector<dir_child *> children;
-  children = read_cont_dir(parent);
+  const dentry *child;
 
-  for (dir_child *entry : children)
-    if (strcmp(entry->file_name, name.c_str()) == 0) {
-      return read_block_attr(entry->index);
-    }
+  if ((child = resolve(parent->first_blk, name)) == nullptr) return nullptr;
 
-  return nullptr;
+  return new dir_entry(child->attr);
 }
 
-// Creates a file on the disk
 void FS::create_dir_entry(dir_entry *entry, const std::string file_content, dir_entry *parent, const int &fat_index) {
   int index, next_size, free_spots;
   int needed_files_count, file_content_size, needed_blocks, found_blocks, block_index;
+  unsigned goal_group;
   uint8_t cell, attr[ENTRY_ATTRIBUTE_SIZE], cont[ENTRY_CONTENT_SIZE];
   uint32_t buffer;
 
   file_content_size = file_content.size();
   needed_blocks = calc_needed_blocks(file_content_size);
 
+  if (parent != nullptr && find_child(parent->first_blk, entry->file_name) != -1) {
+    printf("File named '%s' already exists.\n", entry->file_name);
+    return;
+  }
+
   printf("Needed blocks: %d\n", needed_blocks);
 
   found_blocks = 0;
 
-  int free_blocks[needed_blocks];
+  std::vector<int> free_blocks(needed_blocks);
 
   // FIXME: use arr = {0}
   empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
@@ -175,429 +318,1567 @@ void FS::create_dir_entry(dir_entry *entry, const std::string file_content, dir_
 
   // Find empty block.
 
-  if (fat_index == -1)
-    for (index = 0; index < BLOCK_SIZE / 2 && found_blocks < needed_blocks; index++)
-      if (fat[index] == FAT_FREE) {
-        free_blocks[found_blocks] = index;
+  // Files go in their directory's group, directories are spread over the groups.
+  if (entry->type == TYPE_DIR)
+    goal_group = this->next_group++ % this->groups.size();
+  else
+    goal_group = parent != nullptr ? parent->first_blk / ALLOC_GROUP_BLOCKS : 0;
 
-        if (found_blocks == 0) entry->first_blk = index;
+  if (fat_index == -1 && (found_blocks = find_free_blocks(needed_blocks, &free_blocks[0], goal_group)) > 0) entry->first_blk = free_blocks[0];
 
-        found_blocks++;
-      }
+  if (fat_index == -1 && found_blocks < needed_blocks) {
+    printf("Not enough free blocks for %s.\n", entry->file_name);
+    release_blocks(&free_blocks[0], found_blocks);
+    return;
+  }
 
   printf("Found empty: %d\n", free_blocks[0]);
 
   fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
 
+  // A directory's root points back at its parent.
+  if (entry->type == TYPE_DIR && parent != nullptr) codec::put_le32(cont + N_PARENT_OFFSET, parent->first_blk);
+
   // Write blocks
 
-  if (file_content.empty() && fat_index != -1) {
+  if (entry->type == TYPE_FILE && fat_index == -1 && this->delayed_alloc && this->disk.get_write_mode() == DISK_WRITE_BACK &&
+      file_content.size() <= DELALLOC_MAX_BYTES) {
+    // Only the first block is kept, it was picked with the whole file in
+    // mind. The rest are chosen when the file is flushed.
+    release_blocks(free_blocks.data() + 1, needed_blocks - 1);
+
+    delayed_file &file = this->delayed[entry->first_blk];
+    file.entry = *entry;
+    file.content = file_content;
+    file.parent_blk = parent != nullptr ? parent->first_blk : ROOT_BLOCK;
+    file.reserved = true;
+    this->delayed_bytes += file_content.size();
+  } else if (file_content.empty() && fat_index != -1) {
     this->write_block(attr, cont, fat_index);
+    update_fat();
   } else if (entry->type == TYPE_FILE) {
-    index = 0;
-    block_index = 0;
-    int letters_left = file_content_size;
-
-    for (char letter : file_content) {
-      letters_left--;
-      cont[index++] = letter;
-
-      if (index == ENTRY_CONTENT_SIZE || letters_left == 0) {
-        this->write_block(attr, cont, free_blocks[block_index]);
-        index = 0;
-
-        if (letters_left == 0) {
-          this->fat[free_blocks[block_index]] = FAT_EOF;
-        } else {
-          this->fat[free_blocks[block_index]] = free_blocks[block_index + 1];
-        }
-
-        block_index++;
-        for (int i = 0; i < ENTRY_CONTENT_SIZE; i++) {
-          cont[i] = 0;
-        }
-      }
-    }
+    write_cont_file(entry, file_content, free_blocks.data(), needed_blocks);
+    update_fat();
   } else if (entry->type == TYPE_DIR) {
     this->write_block(attr, cont, free_blocks[0]);
-    this->fat[free_blocks[0]] = FAT_EOF;
+    set_fat(free_blocks[0], FAT_EOF);
+    update_fat();
   }
 
-  update_fat();
-
   // update parent.
 
   if (parent != nullptr) {
     dir_child child;
     strncpy(child.file_name, entry->file_name, 56);
     child.index = entry->first_blk;
+    child.size = entry->size;
+    child.type = entry->type;
+    child.access_rights = entry->access_rights;
     update_dir_content(parent, &child);
   }
-}
 
-// Updates the directorys' children and the size of the entry
-void FS::update_dir_content(dir_entry *entry, dir_child *child, const uint8_t &task) {
-  std::vector<dir_child *> children;
-  uint8_t cont[ENTRY_CONTENT_SIZE], attr[ENTRY_ATTRIBUTE_SIZE], cell;
-  int32_t buffer;
+  if (this->delayed_bytes > DELALLOC_MAX_BYTES) flush_all_delayed();
+}
 
-  int index;                                        // Global variables.
-  int dir_child_size, internal_index, child_index;  // cont variables.
+// Writes the content of a file to its blocks, every block gets the file's
+// attributes, and links them in the FAT.
+void FS::write_cont_file(const dir_entry *entry, const std::string &content, const int *blocks, const int &count) {
+  std::vector<uint8_t> data(count * BLOCK_SIZE, 0);
+  std::vector<block_io> io(count);
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  int index;
 
-  // Make sure the new arrays are truly empty.
+  drop_dentry(blocks[0]);
 
   empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
-  empty_array(cont, ENTRY_CONTENT_SIZE);
-  // Add new child to array.
-  children = read_cont_dir(entry);
+  codec::encode_attr(attr, *entry);
 
-  // TODO: handle remove child.
-  if (task == ADD_DIR_CHILD) {
-    for (dir_child *exi_child : children) {
-      if (strcmp(exi_child->file_name, child->file_name) == 0) {
-        printf("File named '%s' already exists.\n", child->file_name);
-        return;
-      }
-    }
+  for (index = 0; index < count; index++) {
+    uint8_t *block = &data[index * BLOCK_SIZE];
 
-    children.push_back(child);
+    memcpy(block, attr, ENTRY_ATTRIBUTE_SIZE);
+    content.copy((char *)block + ENTRY_ATTRIBUTE_SIZE, ENTRY_CONTENT_SIZE, index * ENTRY_CONTENT_SIZE);
 
-  } else if (task == REMOVE_DIR_CHILD) {
-    index = 0;
-    for (dir_child *exi_child : children) {
-      if (strcmp(exi_child->file_name, child->file_name) == 0) {
-        children.erase(children.begin() + index);
-        break;
-      }
+    io[index].block_no = blocks[index];
+    io[index].blk = block;
 
-      index++;
-    }
-  } else {
-    printf("Something went wrong.\n");
-    return;
+    set_fat(blocks[index], index + 1 < count ? blocks[index + 1] : FAT_EOF);
   }
 
-  entry->size = sizeof(dir_child) * children.size();
+  // All of the file's blocks go out in one vectored write.
+  this->cache.write_blocks(io);
+}
 
-  fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
+// Gives a delayed file its blocks and writes it. The file stays at its
+// first block when the blocks after it are free, otherwise it moves to the
+// blocks the allocator finds for it. Returns the first block of the file, -1
+// if there weren't enough free blocks.
+int FS::place_delayed(const unsigned &first_blk) {
+  unsigned index, goal_group;
+  int needed_blocks, found_blocks;
+  dir_entry *parent;
+  dir_child child;
 
-  // Define cont variables
-  dir_child_size = sizeof(dir_child);
-  internal_index = 0;
-  child_index = 0;
+  auto found = this->delayed.find(first_blk);
 
-  // Adding content to 'cont' for later use.
-  // TODO: Handler dirs with too large content.
+  if (found == this->delayed.end()) return first_blk;
 
-  for (index = 0; index < entry->size; index++) {
-    if (internal_index < 56) {
-      cont[index] = children[child_index]->file_name[internal_index];
-    } else {
-      buffer = children[child_index]->index >> (8 * (internal_index - 56));
-      cell = buffer & 0xff;
-      cont[index] = cell;
-    }
+  delayed_file &file = found->second;
+  alloc_group &group = group_of(first_blk);
 
-    internal_index++;
+  needed_blocks = calc_needed_blocks(file.entry.size);
+  goal_group = first_blk / ALLOC_GROUP_BLOCKS;
 
-    if (internal_index == dir_child_size) {
-      child_index++;
-      internal_index = 0;
-    }
-  }
+  std::vector<int> blocks(needed_blocks);
+  found_blocks = 0;
 
-  write_block(attr, cont, entry->first_blk);
-}
+  {
+    std::lock_guard<std::mutex> guard(group.lock);
 
-// Takes the attributes and content arrays and writes them to disk.
-void FS::write_block(uint8_t attr[ENTRY_ATTRIBUTE_SIZE], uint8_t cont[ENTRY_CONTENT_SIZE], unsigned block_no) {
-  int index;
-  uint8_t block[BLOCK_SIZE];
+    fill_group(group);
 
-  for (index = 0; index < BLOCK_SIZE; index++) block[index] = 0x00;
+    if (file.reserved) group.free_map.set_free(first_blk - group.first);
 
-  for (index = 0; index < ENTRY_ATTRIBUTE_SIZE; index++) block[index] = attr[index];
+    file.reserved = false;
 
-  for (index = 0; index < ENTRY_CONTENT_SIZE; index++) block[index + ENTRY_ATTRIBUTE_SIZE] = cont[index];
+    if (first_blk - group.first + needed_blocks <= group.free_map.get_no_blocks() &&
+        group.free_map.run_length(first_blk - group.first, needed_blocks) >= (unsigned)needed_blocks) {
+      for (index = 0; index < (unsigned)needed_blocks; index++) {
+        blocks[index] = first_blk + index;
+        group.free_map.set_used(first_blk - group.first + index);
+      }
 
-  this->disk.write(block_no, block);
-}
+      found_blocks = needed_blocks;
+    }
+  }
 
-// Gets the attributes for the block on the given index.
-dir_entry *FS::read_block_attr(uint16_t block_index) {
-  uint8_t block[BLOCK_SIZE], attr[ENTRY_ATTRIBUTE_SIZE];
-  uint32_t temp;
+  if (found_blocks < needed_blocks && (found_blocks = find_free_blocks(needed_blocks, blocks.data(), goal_group)) < needed_blocks) {
+    printf("Not enough free blocks for %s.\n", file.entry.file_name);
+    release_blocks(blocks.data(), found_blocks);
 
-  int index, name_size, size_size, blk_size, type_size, access_size;
-  int next_size, current_index;
+    // Keeps its first block if nothing took it in the meantime.
+    std::lock_guard<std::mutex> guard(group.lock);
 
-  dir_entry *entry = new dir_entry;
+    if (group.free_map.is_free(first_blk - group.first)) {
+      group.free_map.set_used(first_blk - group.first);
+      file.reserved = true;
+    }
 
-  name_size = 56;
-  size_size = 4;
-  blk_size = 2;
-  type_size = 1;
-  access_size = 1;
+    return -1;
+  }
 
-  current_index = 0;
-  next_size = name_size;
+  // Moved, the directory has to point at the new first block.
+  if (blocks[0] != (int)first_blk) {
+    parent = file.parent_blk == this->working_dir->first_blk ? this->working_dir : read_block_attr(file.parent_blk);
 
-  temp = 0x00000000;
+    if (parent != nullptr) {
+      strncpy(child.file_name, file.entry.file_name, 56);
+      child.index = blocks[0];
+      update_dir_content(parent, &child, MOVE_DIR_CHILD);
 
-  char file_name[name_size];
+      if (parent != this->working_dir) delete parent;
+    }
 
-  empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
-  empty_array(block, BLOCK_SIZE);
+    file.entry.first_blk = blocks[0];
+  }
 
-  // TODO: handle error code -1
-  this->disk.read(block_index, block);
+  write_cont_file(&file.entry, file.content, blocks.data(), needed_blocks);
+  update_fat();
 
-  for (index = 0; index < ENTRY_ATTRIBUTE_SIZE; index++) attr[index] = block[index];
+  this->delayed_bytes -= file.content.size();
+  this->delayed.erase(found);
 
-  for (index = 0; index < next_size; index++) {
-    file_name[index] = attr[index];
-  }
+  return blocks[0];
+}
 
-  current_index = next_size;
-  next_size += size_size;
+// Flushes a delayed file before its blocks are needed, entry gets the first
+// block the file ended up in.
+int FS::flush_delayed(dir_entry *entry) {
+  int first_blk;
 
-  strncpy(entry->file_name, file_name, 56);
+  if ((first_blk = place_delayed(entry->first_blk)) == -1) return -1;
 
-  // Get size attribute.
-  for (index = next_size - 1; index >= current_index; index--) temp = (temp << 8) | attr[index];
+  entry->first_blk = first_blk;
 
-  entry->size = temp;
+  return 0;
+}
 
-  current_index = next_size;
-  next_size += blk_size;
+// Flushes every delayed file.
+int FS::flush_all_delayed() {
+  std::vector<unsigned> files;
+  int ret = 0;
 
-  // Get first block index in FAT.
-  for (index = next_size - 1; index >= current_index; index--) temp = (temp << 8) | attr[index];
+  // Every first block is given back so a file can grow over the one reserved
+  // after it, which then moves instead.
+  for (auto &file : this->delayed) {
+    int block = file.first;
 
-  entry->first_blk = temp;
+    files.push_back(file.first);
 
-  current_index = next_size;
-  next_size += type_size;
+    if (file.second.reserved) release_blocks(&block, 1);
 
-  // Get type
-  entry->type = attr[current_index];
+    file.second.reserved = false;
+  }
 
-  current_index = next_size;
-  next_size += type_size;
+  // In block order, files created one after the other end up next to each other.
+  std::sort(files.begin(), files.end());
 
-  // Gett access rights
-  entry->access_rights = attr[current_index];
+  for (unsigned first_blk : files)
+    if (place_delayed(first_blk) == -1) ret = -1;
 
-  return entry;
+  return ret;
 }
 
-// Gets all the children from a directory.
-std::vector<dir_child *> FS::read_cont_dir(const dir_entry *directory) {
-  uint8_t block[BLOCK_SIZE], cont[ENTRY_CONTENT_SIZE];
-  uint16_t temp;
-  dir_child *temp_child;
-  std::vector<dir_child *> children;
-
-  char file_name[56];
-  int index, internal_index, dir_child_size;
+// Forgets a delayed file that's removed before it was flushed, the FAT never
+// knew about it.
+void FS::drop_delayed(const unsigned &first_blk) {
+  auto found = this->delayed.find(first_blk);
 
-  dir_child_size = sizeof(dir_child);
-  internal_index = 0;
+  if (found == this->delayed.end()) return;
 
-  this->disk.read(directory->first_blk, block);
+  int block = first_blk;
 
-  for (index = ENTRY_ATTRIBUTE_SIZE; index < (directory->size + ENTRY_ATTRIBUTE_SIZE); index++) {
-    if (internal_index < 56)
-      file_name[internal_index] = block[index];
-    else if (internal_index == 56)
-      temp = (temp << 8) | block[index + 1];
-    else
-      temp = (temp << 8) | block[index - 1];
+  if (found->second.reserved) release_blocks(&block, 1);
 
-    internal_index++;
+  this->delayed_bytes -= found->second.content.size();
+  this->delayed.erase(found);
+}
 
-    if (internal_index == dir_child_size) {
-      temp_child = new dir_child;
+void FS::update_dir_content(dir_entry *entry, dir_child *child, const uint8_t &task) {
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  const uint8_t *block;
+  dir_child added;
+  dir_node leaf;
+  int position;
 
-      strncpy(temp_child->file_name, file_name, 56);
-      temp_child->index = temp;
-      temp = 0;
+  position = find_child(entry->first_blk, child->file_name);
 
-      children.push_back(temp_child);
+  if (task == ADD_DIR_CHILD && position != -1) {
+    printf("File named '%s' already exists.\n", child->file_name);
+    return;
+  }
 
-      internal_index = 0;
-    }
+  if (task != ADD_DIR_CHILD && task != MOVE_DIR_CHILD && task != REMOVE_DIR_CHILD) {
+    printf("Something went wrong.\n");
+    return;
   }
 
-  return children;
-}
+  if (task != ADD_DIR_CHILD && position == -1) return;
 
-// Gets all the content of a file.
-std::string FS::read_cont_file(const dir_entry *entry) {
-  uint8_t block[BLOCK_SIZE];
-  bool reached_end = false;
-  int index, fat_index, next_fat_index;
+  drop_dentry(entry->first_blk, child->file_name);
 
-  fat_index = entry->first_blk;
+  if (task == ADD_DIR_CHILD && this->no_free < DIR_MAX_DEPTH) {
+    printf("Not enough free blocks for directory %s.\n", entry->file_name);
+    return;
+  }
 
-  std::string content;
+  // The size on the disk, the caller's copy may be older.
+  if ((block = this->cache.read_ptr(entry->first_blk)) == nullptr) return;
 
-  while (!reached_end) {
-    this->disk.read(fat_index, block);
+  entry->size = codec::get_le32(block + F_SIZE_OFFSET);
 
-    for (index = ENTRY_ATTRIBUTE_SIZE; index < BLOCK_SIZE && index < (entry->size + ENTRY_ATTRIBUTE_SIZE); index++) content += block[index];
+  if (task == ADD_DIR_CHILD) entry->size += DIR_CHILD_SIZE;
 
-    if ((fat_index = fat[fat_index]) == FAT_EOF) reached_end = true;
-  }
+  if (task == REMOVE_DIR_CHILD) entry->size -= DIR_CHILD_SIZE;
 
-  return content;
-}
+  empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+  fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
 
-// Splits up a string into a path_obj
-int FS::format_path(std::string &path_s, path_obj *path) {
-  // TODO: Handle error.
-  if (path_s.empty()) return 1;
+  if (task == ADD_DIR_CHILD) {
+    added = *child;
+    added.hash = codec::name_hash(child->file_name);
 
-  std::string temp, entry_name;
-  int index;
+    if (btree_insert(entry->first_blk, added, attr) != 0) {
+      printf("Not enough free blocks for directory %s.\n", entry->file_name);
+      drop_dir_index(entry->first_blk);
+      return;
+    }
+  } else {
+    if (find_leaf(entry->first_blk, child->file_name, leaf) != 0) return;
 
-  if (path_s[0] == '/')
-    path->start = START_ROOT;
-  else
-    path->start = START_WDIR;
+    auto item = std::lower_bound(leaf.items.begin(), leaf.items.end(), child->file_name,
+                                 [](const dir_child &item, const char *name) { return strncmp(item.file_name, name, 56) < 0; });
 
-  for (index = 0; index < path_s.size(); index++) {
-    if (index == 0 && path->start == START_ROOT) index++;
+    if (item == leaf.items.end() || strncmp(item->file_name, child->file_name, 56) != 0) return;
 
-    if (path_s[index] == '/') {
-      path->dirs.push_back(entry_name);
-      entry_name.clear();
+    if (task == MOVE_DIR_CHILD) {
+      item->index = child->index;
     } else {
-      temp = path_s[index];
-      entry_name.append(temp);
+      leaf.items.erase(item);
+      refill_bloom(entry->first_blk, position, leaf, attr);
     }
+
+    write_node(leaf, attr);
   }
 
-  path->dirs.push_back(entry_name);
-  entry_name.clear();
+  rewrite_attr(entry);
 
-  path->end = path->dirs[path->dirs.size() - 1];
-  path->dirs.pop_back();
+  // The parent lists the new size.
+  if (entry->first_blk != ROOT_BLOCK) update_child_attr(dir_parent(entry->first_blk), entry);
 
-  return 0;
-}
+  // The index follows, children keep their place but the last one fills a
+  // removed child's.
+  auto found = this->dir_indexes.find(entry->first_blk);
 
-// Calculates the amount of needed blocks for a file.
-int FS::calc_needed_blocks(const unsigned long &size) {
-  int current_val, count;
+  if (found == this->dir_indexes.end()) return;
 
-  current_val = size;
-  count = 0;
+  dir_index &index = found->second;
 
-  while (current_val > 0) {
-    count++;
-    current_val -= ENTRY_CONTENT_SIZE;
-  }
+  if (task == ADD_DIR_CHILD) {
+    index.slots.emplace(added.hash, index.children.size());
+    index.children.push_back(added);
+  } else if (task == MOVE_DIR_CHILD) {
+    index.children[position].index = child->index;
+  } else {
+    unsigned last = index.children.size() - 1;
 
-  if (count == 0) count = 1;
+    for (unsigned moved : {(unsigned)position, last}) {
+      auto range = index.slots.equal_range(index.children[moved].hash);
 
-  return count;
-}
+      for (auto slot = range.first; slot != range.second; slot++)
+        if (slot->second == moved) {
+          index.slots.erase(slot);
+          break;
+        }
+    }
 
-FS::FS() {
-  std::cout << "FS::FS()... Creating file system\n";
-  load_fat();
-  this->working_dir = read_block_attr(ROOT_BLOCK);
+    if ((unsigned)position != last) {
+      index.children[position] = index.children[last];
+      index.slots.emplace(index.children[position].hash, position);
+    }
+
+    index.children.pop_back();
+  }
 }
 
-FS::~FS() { delete this->working_dir; }
+// Writes a directory over with the given children, its tree is built again
+// from an empty root.
+void FS::write_dir_content(dir_entry *entry, const std::vector<dir_child *> &children) {
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  unsigned count;
+  int32_t block, next;
+  dir_node root;
+  dir_child child;
+
+  // Every block but the root is given back.
+  block = fat_entry(entry->first_blk);
+
+  for (count = 0; block > 0 && block < (int32_t)this->fat.size() && count < this->fat.size(); count++) {
+    next = fat_entry(block);
+    set_fat(block, FAT_FREE);
+    this->cache.invalidate(block);
+    block = next;
+  }
 
-Disk *FS::get_disk() { return &this->disk; }
+  set_fat(entry->first_blk, FAT_EOF);
 
-int16_t *FS::get_fat() { return this->fat; }
+  // Any name in it may be gone.
+  drop_dir_dentries(entry->first_blk);
 
-int16_t FS::get_working_dir_blk_index() { return this->working_dir->first_blk; }
-// formats the disk, i.e., creates an empty file system
-int FS::format() {
-  int index, cap;
-  uint8_t block[BLOCK_SIZE] = {0};
-  uint8_t cell;
-  uint16_t entry;
-  uint32_t val;
+  entry->size = DIR_CHILD_SIZE * children.size();
 
-  cap = this->disk.get_no_blocks();
+  empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+  fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
 
-  fs_obj::directory_t root;
-  fs_obj::dir_entry root_attr;
-  root_attr.first_blk = ROOT_BLOCK;
-  root_attr.type = TYPE_DIR;
-  root_attr.access_rights = READ | WRITE;
-  strcpy(root_attr.file_name, "/");
+  root.block = entry->first_blk;
+  root.leaf = true;
+  root.link = 0;
+  root.parent = dir_parent(entry->first_blk);
+  write_node(root, attr);
 
-  root.attributes = root_attr;
-  fs_obj::create_dir(this, &root, nullptr);
+  dir_index written;
 
-  // Create fat.
-  for (index = 0; index < BLOCK_SIZE; index += 2) {
-    if (index == 0 || index == 1)
-      entry = FAT_EOF;
-    else if (index == 2 || index == 3)
-      entry = FAT_EOF;
-    else
-      entry = FAT_FREE;
+  for (dir_child *from : children) {
+    child = *from;
+    child.hash = codec::name_hash(child.file_name);
+
+    if (btree_insert(entry->first_blk, child, attr) != 0) {
+      printf("Not enough free blocks for directory %s.\n", entry->file_name);
+      break;
+    }
 
-    block[index] = entry & 0xff;
-    entry = entry >> 8;
-    block[index + 1] = entry & 0xff;
+    written.children.push_back(child);
   }
 
-  this->disk.write(FAT_BLOCK, block);
+  entry->size = DIR_CHILD_SIZE * written.children.size();
+  rewrite_attr(entry);
+  update_fat();
+
+  if (entry->first_blk != ROOT_BLOCK) update_child_attr(root.parent, entry);
 
-  this->load_fat();
+  store_dir_index(entry->first_blk, std::move(written));
+}
 
-  this->working_dir = read_block_attr(ROOT_BLOCK);
+// Reads one node of a directory, returns -1 if the block can't be read or
+// doesn't hold a node.
+int FS::read_node(const unsigned &block, dir_node &node) {
+  const uint8_t *data, *content;
+  unsigned index, count, type;
+  dir_child item;
+
+  if ((data = this->cache.read_ptr(block)) == nullptr) return -1;
+
+  content = data + ENTRY_ATTRIBUTE_SIZE;
+  type = codec::get_le32(content + N_TYPE_OFFSET);
+  count = codec::get_le32(content + N_COUNT_OFFSET);
+
+  if ((type != NODE_LEAF && type != NODE_INTERNAL) || count > (type == NODE_LEAF ? DIR_LEAF_CHILDREN : DIR_NODE_KEYS)) return -1;
+
+  node.block = block;
+  node.leaf = type == NODE_LEAF;
+  node.link = codec::get_le32(content + N_LINK_OFFSET);
+  node.parent = codec::get_le32(content + N_PARENT_OFFSET);
+  memcpy(node.bloom, content + N_BLOOM_OFFSET, DIR_BLOOM_SIZE);
+  node.items.clear();
+  node.items.reserve(count);
+
+  for (index = 0; index < count; index++) {
+    if (node.leaf) {
+      codec::decode_child(item.file_name, item.index, content + DIR_NODE_HEADER_SIZE + index * DIR_CHILD_SIZE);
+      item.hash = codec::decode_child_hash(content + DIR_NODE_HEADER_SIZE + index * DIR_CHILD_SIZE);
+      codec::decode_child_attr(item, content + DIR_NODE_HEADER_SIZE + index * DIR_CHILD_SIZE);
+    } else {
+      codec::decode_child(item.file_name, item.index, content + DIR_NODE_HEADER_SIZE + index * DIR_KEY_SIZE);
+      item.hash = item.size = item.type = item.access_rights = 0;
+    }
+
+    node.items.push_back(item);
+  }
 
   return 0;
 }
 
-// create <filepath> creates a new file on the disk, the data content is
-// written on the following rows (ended with an empty row)
-int FS::create(std::string filepath) {
-  std::string buffer;
-  std::string input;
-  int needed_files, index, j;
+// Writes one node of a directory behind the given attributes. On a
+// write-through disk the chains its records point into are on the disk
+// first.
+void FS::write_node(const dir_node &node, const uint8_t *attr) {
+  uint8_t block[BLOCK_SIZE] = {0};
+  uint8_t *content;
+  unsigned index;
 
-  uint8_t block[BLOCK_SIZE];
-  uint8_t cell;
-  uint32_t val;
+  if (!this->fat_dirty.empty() && this->disk.get_write_mode() == DISK_WRITE_THROUGH) flush_fat();
 
-  path_obj path;
+  memcpy(block, attr, ENTRY_ATTRIBUTE_SIZE);
+  content = block + ENTRY_ATTRIBUTE_SIZE;
 
-  while (std::getline(std::cin, buffer) && !buffer.empty()) {
-    input.append(buffer);
-    input.append("\n");
+  codec::put_le32(content + N_TYPE_OFFSET, node.leaf ? NODE_LEAF : NODE_INTERNAL);
+  codec::put_le32(content + N_COUNT_OFFSET, node.items.size());
+  codec::put_le32(content + N_LINK_OFFSET, node.link);
+  codec::put_le32(content + N_PARENT_OFFSET, node.parent);
+  memcpy(content + N_BLOOM_OFFSET, node.bloom, DIR_BLOOM_SIZE);
+
+  for (index = 0; index < node.items.size(); index++) {
+    if (node.leaf) {
+      codec::encode_child(content + DIR_NODE_HEADER_SIZE + index * DIR_CHILD_SIZE, node.items[index].file_name, node.items[index].index);
+      codec::encode_child_attr(content + DIR_NODE_HEADER_SIZE + index * DIR_CHILD_SIZE, node.items[index]);
+    } else {
+      codec::encode_key(content + DIR_NODE_HEADER_SIZE + index * DIR_KEY_SIZE, node.items[index].file_name, node.items[index].index);
+    }
   }
 
-  // TODO: check if disk is full.
+  drop_dentry(node.block);
 
-  dir_entry file;
+  this->cache.write(node.block, block);
+}
 
-  if (format_path(filepath, &path) != 0) {
-    printf("%s is not a valid path.\n", filepath.c_str());
-    return 0;
-  }
+// Takes a block for a new node of a directory, near its first block. It's
+// linked right after the first block, the order of the chain doesn't matter.
+int FS::new_node(const unsigned &dir_blk, unsigned &block) {
+  int found;
 
-  // TODO: Check if works with longer paths.
-  dir_entry *parent;
-  if ((parent = follow_path(&path)) == nullptr) {
-    printf("Path: %s doesnt exist\n", filepath.c_str());
-    return 0;
-  }
+  if (find_free_blocks(1, &found, dir_blk / ALLOC_GROUP_BLOCKS) != 1) return -1;
 
-  std::cout << parent->first_blk << std::endl;
+  set_fat(found, fat_entry(dir_blk));
+  set_fat(dir_blk, found);
 
-  // TODO: give reason.
-  if (parent == nullptr) return 0;
+  block = found;
+
+  return 0;
+}
+
+// Adds a child below the node in block. Returns 1 when the node split, split
+// then gets the first name and the block of its new upper half, 0 when it
+// didn't and -1 when there wasn't a free block for a split.
+int FS::insert_child(const unsigned &dir_blk, const unsigned &block, const dir_child &child, const uint8_t *attr, dir_child &split) {
+  dir_node node, upper;
+  dir_child promoted;
+  unsigned half;
+  bool grown;
+  int ret;
+
+  if (read_node(block, node) != 0) return -1;
+
+  // The root's filter gets every name added below it.
+  grown = block == dir_blk && codec::bloom_add(node.bloom, child.hash);
+
+  // The last key at or before the name leads to its subtree.
+  auto item = std::upper_bound(node.items.begin(), node.items.end(), child.file_name,
+                               [](const char *name, const dir_child &item) { return strncmp(name, item.file_name, 56) < 0; });
+
+  if (node.leaf) {
+    node.items.insert(item, child);
+
+    if (node.items.size() <= DIR_LEAF_CHILDREN) {
+      write_node(node, attr);
+      return 0;
+    }
+  } else {
+    if ((ret = insert_child(dir_blk, item == node.items.begin() ? node.link : std::prev(item)->index, child, attr, promoted)) != 1) {
+      if (ret == 0 && grown) write_node(node, attr);
+      return ret;
+    }
+
+    node.items.insert(item, promoted);
+
+    if (node.items.size() <= DIR_NODE_KEYS) {
+      write_node(node, attr);
+      return 0;
+    }
+  }
+
+  // The upper half moves to a new node.
+  if (new_node(dir_blk, upper.block) != 0) return -1;
+
+  half = node.items.size() / 2;
+  upper.leaf = node.leaf;
+
+  if (node.leaf) {
+    upper.items.assign(node.items.begin() + half, node.items.end());
+    upper.link = node.link;
+    node.link = upper.block;
+  } else {
+    // The middle key moves up, its subtree starts the upper half.
+    upper.items.assign(node.items.begin() + half + 1, node.items.end());
+    upper.link = node.items[half].index;
+  }
+
+  memcpy(split.file_name, node.items[half].file_name, 56);
+  split.index = upper.block;
+  split.hash = 0;
+
+  node.items.resize(half);
+
+  write_node(upper, attr);
+  write_node(node, attr);
+
+  return 1;
+}
+
+// Adds a child to a directory. A root that splits keeps its block, its lower
+// half moves to a new node below it.
+int FS::btree_insert(const unsigned &dir_blk, const dir_child &child, const uint8_t *attr) {
+  dir_node root, lower;
+  dir_child split;
+  int ret;
+
+  if ((ret = insert_child(dir_blk, dir_blk, child, attr, split)) != 1) return ret;
+
+  if (read_node(dir_blk, lower) != 0 || new_node(dir_blk, lower.block) != 0) return -1;
+
+  // The parent and the filter stay in the root.
+  root.parent = lower.parent;
+  lower.parent = 0;
+  memcpy(root.bloom, lower.bloom, DIR_BLOOM_SIZE);
+  memset(lower.bloom, 0, DIR_BLOOM_SIZE);
+
+  write_node(lower, attr);
+
+  root.block = dir_blk;
+  root.leaf = false;
+  root.link = lower.block;
+  root.items.push_back(split);
+  write_node(root, attr);
+
+  return 0;
+}
+
+// Finds the leaf of a directory the name belongs in.
+int FS::find_leaf(const unsigned &dir_blk, const char *name, dir_node &leaf) {
+  unsigned depth;
+
+  if (read_node(dir_blk, leaf) != 0) return -1;
+
+  for (depth = 0; !leaf.leaf; depth++) {
+    auto item = std::upper_bound(leaf.items.begin(), leaf.items.end(), name,
+                                 [](const char *name, const dir_child &item) { return strncmp(name, item.file_name, 56) < 0; });
+
+    if (depth >= DIR_MAX_DEPTH || read_node(item == leaf.items.begin() ? leaf.link : std::prev(item)->index, leaf) != 0) return -1;
+  }
+
+  return 0;
+}
+
+// Builds the filter of a directory again without the child at position
+// removed, a name's bits can't be taken out one at a time. It goes in the
+// leaf when that's the root, which the caller writes.
+void FS::refill_bloom(const unsigned &dir_blk, const int &removed, dir_node &leaf, const uint8_t *attr) {
+  uint8_t bloom[DIR_BLOOM_SIZE] = {0};
+  dir_node root;
+  unsigned position;
+
+  const dir_index &index = directory_index(dir_blk);
+
+  for (position = 0; position < index.children.size(); position++)
+    if ((int)position != removed) codec::bloom_add(bloom, index.children[position].hash);
+
+  if (leaf.block == dir_blk) {
+    memcpy(leaf.bloom, bloom, DIR_BLOOM_SIZE);
+  } else if (read_node(dir_blk, root) == 0 && memcmp(root.bloom, bloom, DIR_BLOOM_SIZE) != 0) {
+    memcpy(root.bloom, bloom, DIR_BLOOM_SIZE);
+    write_node(root, attr);
+  }
+}
+
+// Gets the block of the directory listing the directory in dir_blk.
+unsigned FS::dir_parent(const unsigned &dir_blk) {
+  const uint8_t *data;
+
+  if ((data = this->cache.read_ptr(dir_blk)) == nullptr) return ROOT_BLOCK;
+
+  return codec::get_le32(data + ENTRY_ATTRIBUTE_SIZE + N_PARENT_OFFSET);
+}
+
+// Copies the size, type and access rights of an entry to the child listing
+// it in the directory in parent_blk.
+void FS::update_child_attr(const unsigned &parent_blk, const dir_entry *entry) {
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  const uint8_t *data;
+  dir_node leaf;
+  int position;
+
+  if ((position = find_child(parent_blk, entry->file_name)) == -1 || find_leaf(parent_blk, entry->file_name, leaf) != 0) return;
+
+  auto item = std::lower_bound(leaf.items.begin(), leaf.items.end(), entry->file_name,
+                               [](const dir_child &item, const char *name) { return strncmp(item.file_name, name, 56) < 0; });
+
+  if (item == leaf.items.end() || strncmp(item->file_name, entry->file_name, 56) != 0) return;
+
+  if (item->size == entry->size && item->type == entry->type && item->access_rights == entry->access_rights) return;
+
+  item->size = entry->size;
+  item->type = entry->type;
+  item->access_rights = entry->access_rights;
+
+  // The leaf keeps the directory's attributes.
+  if ((data = this->cache.read_ptr(leaf.block)) == nullptr) return;
+
+  memcpy(attr, data, ENTRY_ATTRIBUTE_SIZE);
+  write_node(leaf, attr);
+
+  auto found = this->dir_indexes.find(parent_blk);
+
+  if (found != this->dir_indexes.end()) found->second.children[position] = *item;
+}
+
+// gets the children of the directory in dir_blk in name order, returns -1
+// if its blocks can't be read
+int FS::dir_children(const uint32_t &dir_blk, std::vector<dir_child> &children) {
+  unsigned depth, leaves;
+  dir_node node;
+
+  if (read_node(dir_blk, node) != 0) return -1;
+
+  // Down the first subtrees to the first leaf, then along the leaves.
+  for (depth = 0; !node.leaf; depth++)
+    if (depth >= DIR_MAX_DEPTH || read_node(node.link, node) != 0) return -1;
+
+  for (leaves = 0;; leaves++) {
+    children.insert(children.end(), node.items.begin(), node.items.end());
+
+    if (node.link == 0 || leaves >= this->fat.size() || read_node(node.link, node) != 0) break;
+  }
+
+  return 0;
+}
+
+// Gets the index of a directory, reading its tree only the first time.
+const dir_index &FS::directory_index(const unsigned &block) {
+  static const dir_index none;
+  dir_index index;
+
+  auto found = this->dir_indexes.find(block);
+
+  if (found != this->dir_indexes.end()) {
+    this->dir_index_lru.splice(this->dir_index_lru.begin(), this->dir_index_lru, found->second.recent);
+    return found->second;
+  }
+
+  if (dir_children(block, index.children) != 0) return none;
+
+  store_dir_index(block, std::move(index));
+
+  return this->dir_indexes[block];
+}
+
+// Keeps the index of a directory, dropping the least recently used one when
+// there are DIR_INDEX_CAPACITY already. The slots are built from the stored
+// hashes.
+void FS::store_dir_index(const unsigned &block, dir_index &&index) {
+  unsigned position;
+
+  drop_dir_index(block);
+
+  if (this->dir_indexes.size() >= DIR_INDEX_CAPACITY) drop_dir_index(this->dir_index_lru.back());
+
+  index.slots.reserve(index.children.size());
+
+  for (position = 0; position < index.children.size(); position++) index.slots.emplace(index.children[position].hash, position);
+
+  this->dir_index_lru.push_front(block);
+  index.recent = this->dir_index_lru.begin();
+  this->dir_indexes[block] = std::move(index);
+}
+
+void FS::drop_dir_index(const unsigned &block) {
+  auto found = this->dir_indexes.find(block);
+
+  if (found == this->dir_indexes.end()) return;
+
+  this->dir_index_lru.erase(found->second.recent);
+  this->dir_indexes.erase(found);
+}
+
+// Returns the position of the child with the given name in the directory in
+// block, -1 if there is none. A directory that isn't indexed answers for a
+// name its filter doesn't have without reading its tree. The filter has a
+// fixed size, in a large directory it fills up and is passed over.
+int FS::find_child(const unsigned &block, const char *name) {
+  const uint8_t *data;
+  uint32_t hash;
+
+  hash = codec::name_hash(name);
+  data = this->dir_indexes.count(block) == 0 ? this->cache.read_ptr(block) : nullptr;
+
+  if (data != nullptr && !codec::bloom_full(data + ENTRY_ATTRIBUTE_SIZE + N_BLOOM_OFFSET) &&
+      !codec::bloom_test(data + ENTRY_ATTRIBUTE_SIZE + N_BLOOM_OFFSET, hash)) {
+    this->bloom_skips++;
+    return -1;
+  }
+
+  const dir_index &index = directory_index(block);
+
+  auto range = index.slots.equal_range(hash);
+
+  for (auto slot = range.first; slot != range.second; slot++)
+    if (strncmp(index.children[slot->second].file_name, name, 56) == 0) return slot->second;
+
+  return -1;
+}
+
+// Gets the child with the given name of the directory in parent_blk, nullptr
+// if it has none. Both answers stay in the dentry cache until the name or
+// the entry changes, the pointer is only good until then.
+const dentry *FS::resolve(const unsigned &parent_blk, const std::string &name) {
+  dentry_key key{parent_blk, name.substr(0, 56)};
+  dir_entry *entry;
+  unsigned block;
+  int position;
+
+  auto found = this->dentries.find(key);
+
+  if (found != this->dentries.end()) {
+    this->dentry_lru.splice(this->dentry_lru.begin(), this->dentry_lru, found->second.recent);
+    this->dentry_hits++;
+    return found->second.missing ? nullptr : &found->second;
+  }
+
+  this->dentry_misses++;
+
+  if ((position = find_child(parent_blk, key.name.c_str())) == -1) {
+    store_dentry(std::move(key), true, 0);
+    return nullptr;
+  }
+
+  block = directory_index(parent_blk).children[position].index;
+
+  if ((entry = read_block_attr(block)) == nullptr) return nullptr;
+
+  dentry &cached = store_dentry(std::move(key), false, block);
+
+  cached.attr = *entry;
+
+  delete entry;
+
+  return &cached;
+}
+
+// Adds a name to the dentry cache, dropping the least recently used one when
+// there are DENTRY_CACHE_CAPACITY already.
+dentry &FS::store_dentry(dentry_key &&key, const bool &missing, const unsigned &block) {
+  // A block is cached under one name at a time.
+  if (!missing) drop_dentry(block);
+
+  if (this->dentries.size() >= DENTRY_CACHE_CAPACITY) erase_dentry(this->dentries.find(*this->dentry_lru.back()));
+
+  if (!missing) this->dentry_blocks[block] = key;
+
+  this->dentry_parents[key.parent]++;
+
+  auto stored = this->dentries.emplace(std::move(key), dentry()).first;
+  dentry &cached = stored->second;
+
+  cached.missing = missing;
+  cached.block = block;
+  // The key stays put in its node while the map grows.
+  this->dentry_lru.push_front(&stored->first);
+  cached.recent = this->dentry_lru.begin();
+
+  return cached;
+}
+
+void FS::erase_dentry(dentry_map::iterator found) {
+  auto parent = this->dentry_parents.find(found->first.parent);
+
+  if (--parent->second == 0) this->dentry_parents.erase(parent);
+
+  if (!found->second.missing) this->dentry_blocks.erase(found->second.block);
+
+  this->dentry_lru.erase(found->second.recent);
+  this->dentries.erase(found);
+}
+
+// Drops the cached answer for a name in the directory in parent_blk.
+void FS::drop_dentry(const unsigned &parent_blk, const char *name) {
+  auto found = this->dentries.find(dentry_key{parent_blk, std::string(name, strnlen(name, 56))});
+
+  if (found != this->dentries.end()) erase_dentry(found);
+}
+
+// Drops the cached entry whose first block is block.
+void FS::drop_dentry(const unsigned &block) {
+  auto found = this->dentry_blocks.find(block);
+
+  if (found != this->dentry_blocks.end()) erase_dentry(this->dentries.find(found->second));
+}
+
+// Drops every cached name in the directory in dir_blk, its block may become
+// another directory.
+void FS::drop_dir_dentries(const unsigned &dir_blk) {
+  if (this->dentry_parents.count(dir_blk) == 0) return;
+
+  for (auto found = this->dentries.begin(); found != this->dentries.end();) {
+    auto next = std::next(found);
+
+    if (found->first.parent == dir_blk) erase_dentry(found);
+
+    found = next;
+  }
+}
+
+// Takes the attributes and content arrays and writes them to disk.
+void FS::write_block(uint8_t attr[ENTRY_ATTRIBUTE_SIZE], uint8_t cont[ENTRY_CONTENT_SIZE], unsigned block_no) {
+  int index;
+  uint8_t block[BLOCK_SIZE];
+
+  for (index = 0; index < BLOCK_SIZE; index++) block[index] = 0x00;
+
+  for (index = 0; index < ENTRY_ATTRIBUTE_SIZE; index++) block[index] = attr[index];
+
+  for (index = 0; index < ENTRY_CONTENT_SIZE; index++) block[index + ENTRY_ATTRIBUTE_SIZE] = cont[index];
+
+  this->cache.write(block_no, block);
+}
+
+// Gets the attributes for the block on the given index.
+dir_entry *FS::read_block_attr(uint32_t block_index) {
+  const uint8_t *block;
+
+  auto found = this->delayed.find(block_index);
+
+  // Delayed files aren't on the disk yet.
+  if (found != this->delayed.end()) return new dir_entry(found->second.entry);
+
+  if ((block = this->cache.read_ptr(block_index)) == nullptr) return nullptr;
+
+  dir_entry *entry = new dir_entry;
+
+  codec::decode_attr(*entry, block);
+
+  return entry;
+}
+
+// Gets all the children from a directory, in name order.
+std::vector<dir_child *> FS::read_cont_dir(const dir_entry *directory) {
+  std::vector<dir_child *> children;
+  std::vector<dir_child> found;
+
+  dir_children(directory->first_blk, found);
+
+  for (const dir_child &child : found) children.push_back(new dir_child(child));
+
+  return children;
+}
+
+// Finds a free extent of length blocks in a group with the allocation
+// policy, returns its first block counted from the group's first or -1. The
+// group's lock is held.
+int FS::find_extent(alloc_group &group, const unsigned &length) {
+  if (this->alloc_policy == ALLOC_NEXT_FIT) return group.free_map.find_next_fit(length, group.cursor);
+
+  if (this->alloc_policy == ALLOC_BEST_FIT) return group.free_map.find_best_fit(length);
+
+  return group.free_map.find_run(length);
+}
+
+// Reserves an extent of length blocks in a group, or its longest extent up
+// to length blocks. Returns how many blocks were reserved.
+int FS::take_extent(alloc_group &group, const unsigned &length, int *free_blocks, const bool &longest) {
+  std::lock_guard<std::mutex> guard(group.lock);
+  unsigned index, found;
+  int start;
+
+  fill_group(group);
+
+  found = length;
+
+  if ((start = longest ? group.free_map.find_longest(found) : find_extent(group, length)) == -1) return 0;
+
+  found = std::min(found, length);
+
+  for (index = 0; index < found; index++) {
+    free_blocks[index] = group.first + start + index;
+    group.free_map.set_used(start + index);
+  }
+
+  group.cursor = start + found;
+
+  return found;
+}
+
+// Finds free blocks for a file, in one extent if there is one long enough,
+// otherwise in as few extents as possible. Groups are searched from
+// goal_group on. The blocks are reserved in the free space bitmaps until set
+// in the FAT or released. Returns how many were found.
+int FS::find_free_blocks(const int &needed_blocks, int *free_blocks, const unsigned &goal_group) {
+  unsigned index, no_groups;
+  int found_blocks, count;
+
+  no_groups = this->groups.size();
+  found_blocks = 0;
+
+  for (index = 0; index < no_groups && found_blocks == 0; index++)
+    found_blocks = take_extent(*this->groups[(goal_group + index) % no_groups], needed_blocks, free_blocks, false);
+
+  for (index = 0; index < no_groups && found_blocks < needed_blocks;) {
+    count = take_extent(*this->groups[(goal_group + index) % no_groups], needed_blocks - found_blocks, free_blocks + found_blocks, true);
+
+    if (count == 0)
+      index++;
+    else
+      found_blocks += count;
+  }
+
+  return found_blocks;
+}
+
+// Gives blocks from find_free_blocks back when they weren't used.
+void FS::release_blocks(const int *blocks, const int &count) {
+  int index;
+
+  for (index = 0; index < count; index++) {
+    alloc_group &group = group_of(blocks[index]);
+    std::lock_guard<std::mutex> guard(group.lock);
+
+    group.free_map.set_free(blocks[index] - group.first);
+  }
+}
+
+// Gets the chain of a file from its index, following the FAT only the first
+// time. The reference is valid until the FAT changes. A directory's chain
+// goes on to the end, its size doesn't say how many nodes it has.
+const std::vector<unsigned> &FS::file_chain(const dir_entry *entry) {
+  std::vector<unsigned> chain;
+  int index, fat_index, needed_blocks;
+
+  needed_blocks = entry->type == TYPE_DIR ? this->fat.size() : calc_needed_blocks(entry->size);
+
+  auto found = this->chains.find(entry->first_blk);
+
+  if (found != this->chains.end() && (entry->type == TYPE_DIR || (int)found->second.blocks.size() == needed_blocks)) {
+    this->chain_lru.splice(this->chain_lru.begin(), this->chain_lru, found->second.recent);
+    return found->second.blocks;
+  }
+
+  fat_index = entry->first_blk;
+
+  for (index = 0; index < needed_blocks && fat_index >= 0 && fat_index < (int)this->disk.get_no_blocks(); index++) {
+    chain.push_back(fat_index);
+    fat_index = fat_entry(fat_index);
+  }
+
+  store_chain(entry->first_blk, std::move(chain));
+
+  return this->chains[entry->first_blk].blocks;
+}
+
+// Keeps the index of a chain, dropping the least recently used one when
+// there are CHAIN_INDEX_CAPACITY already.
+void FS::store_chain(const unsigned &first_blk, std::vector<unsigned> &&chain) {
+  drop_chain(first_blk);
+
+  if (this->chains.size() >= CHAIN_INDEX_CAPACITY) drop_chain(this->chain_lru.back());
+
+  if (!chain.empty()) this->chain_tails[chain.back()] = first_blk;
+
+  chain_index &index = this->chains[first_blk];
+
+  index.blocks = std::move(chain);
+  this->chain_lru.push_front(first_blk);
+  index.recent = this->chain_lru.begin();
+}
+
+void FS::drop_chain(unsigned first_blk) {
+  auto found = this->chains.find(first_blk);
+
+  if (found == this->chains.end()) return;
+
+  if (!found->second.blocks.empty()) this->chain_tails.erase(found->second.blocks.back());
+
+  this->chain_lru.erase(found->second.recent);
+  this->chains.erase(found);
+}
+
+// Drops the index of the chain a changed FAT entry belongs to. Chains only
+// change at their first block, when the file is removed, or at their last
+// block, when it grows. Whoever cuts or replaces a chain anywhere else, like
+// fsck repair and defrag, drops its index.
+void FS::invalidate_chain(const unsigned &block) {
+  auto tail = this->chain_tails.find(block);
+
+  if (tail != this->chain_tails.end()) drop_chain(tail->second);
+
+  drop_chain(block);
+}
+
+// Splits a chain into its runs of adjacent blocks.
+std::vector<extent> FS::chain_extents(const std::vector<unsigned> &chain) {
+  std::vector<extent> extents;
+  extent current;
+
+  for (unsigned block : chain) {
+    if (!extents.empty() && extents.back().start + extents.back().length == block) {
+      extents.back().length++;
+      continue;
+    }
+
+    current.start = block;
+    current.length = 1;
+    extents.push_back(current);
+  }
+
+  return extents;
+}
+
+// Asks the disk to prefetch count blocks of a chain, starting at start.
+void FS::readahead(const std::vector<unsigned> &chain, const unsigned &start, const unsigned &count) {
+  if (start >= chain.size() || count == 0) return;
+
+  std::vector<unsigned> blocks(chain.begin() + start, chain.begin() + std::min<size_t>(start + count, chain.size()));
+
+  this->disk.readahead(blocks);
+}
+
+// Reads blocks through the cache. When the disk does asynchronous I/O the
+// blocks missing from the cache are kept in flight up to its queue depth.
+int FS::read_blocks(std::vector<block_io> &io) {
+  std::vector<aio_request> done;
+  const uint8_t *cached;
+  unsigned index;
+  int ret = 0;
+
+  if (!this->disk.use_async()) return this->cache.read_blocks(io);
+
+  // Waits for at least one read and caches what came back.
+  auto reap = [&]() {
+    if (this->disk.complete(done) < 0) return false;
+
+    for (aio_request &request : done) {
+      if (request.result == 0)
+        this->cache.store(request.block_no, request.blk);
+      else
+        ret = -1;
+    }
+
+    done.clear();
+
+    return true;
+  };
+
+  for (index = 0; index < io.size(); index++) {
+    if ((cached = this->cache.peek(io[index].block_no)) != nullptr) {
+      memcpy(io[index].blk, cached, BLOCK_SIZE);
+      continue;
+    }
+
+    while (this->disk.queue_full())
+      if (!reap()) return -1;
+
+    if (!this->disk.submit_read(io[index].block_no, io[index].blk)) return -1;
+  }
+
+  while (this->disk.get_in_flight() > 0)
+    if (!reap()) return -1;
+
+  return ret;
+}
+
+// Copies blocks to new blocks, giving every copy the attributes attr. When
+// the disk does asynchronous I/O reads of the next blocks are in flight while
+// earlier blocks are written.
+int FS::copy_blocks(const std::vector<unsigned> &src_blocks, const int *dest_blocks, const uint8_t *attr) {
+  std::vector<aio_request> done;
+  std::vector<block_io> io;
+  std::vector<uint8_t> buffers;
+  std::vector<int> free_buffers, buffer_dest;
+  unsigned index, depth;
+  int ret, buffer;
+
+  if (!this->disk.use_async()) {
+    unsigned start, count, window;
+
+    // A window at a time, the next one is prefetched while this one is copied.
+    window = READAHEAD_MIN;
+
+    for (start = 0; start < src_blocks.size(); start += count) {
+      count = std::min<size_t>(window, src_blocks.size() - start);
+      window = std::min(window * 2, (unsigned)READAHEAD_MAX);
+
+      readahead(src_blocks, start + count, window);
+
+      buffers.resize(count * BLOCK_SIZE);
+      io.resize(count);
+
+      for (index = 0; index < count; index++) {
+        io[index].block_no = src_blocks[start + index];
+        io[index].blk = &buffers[index * BLOCK_SIZE];
+      }
+
+      if (this->cache.read_blocks(io) != 0) return -1;
+
+      for (index = 0; index < count; index++) {
+        memcpy(io[index].blk, attr, ENTRY_ATTRIBUTE_SIZE);
+        io[index].block_no = dest_blocks[start + index];
+      }
+
+      if (this->cache.write_blocks(io) != 0) return -1;
+    }
+
+    return 0;
+  }
+
+  // One buffer per request that can be in flight, each is read into and
+  // then written from.
+  depth = AIO_QUEUE_DEPTH;
+  buffers.resize(depth * BLOCK_SIZE);
+  buffer_dest.resize(depth);
+
+  for (buffer = depth - 1; buffer >= 0; buffer--) free_buffers.push_back(buffer);
+
+  ret = 0;
+
+  for (index = 0; index < src_blocks.size() || this->disk.get_in_flight() > 0;) {
+    if (index < src_blocks.size() && !free_buffers.empty() && !this->disk.queue_full()) {
+      buffer = free_buffers.back();
+      free_buffers.pop_back();
+      buffer_dest[buffer] = dest_blocks[index];
+
+      if (!this->disk.submit_read(src_blocks[index], &buffers[buffer * BLOCK_SIZE])) return -1;
+
+      index++;
+      continue;
+    }
+
+    if (this->disk.complete(done) < 0) return -1;
+
+    for (aio_request &request : done) {
+      buffer = (request.blk - &buffers[0]) / BLOCK_SIZE;
+
+      if (request.result != 0) {
+        ret = -1;
+        free_buffers.push_back(buffer);
+      } else if (!request.is_write) {
+        // The read left a slot in the queue for the write.
+        memcpy(request.blk, attr, ENTRY_ATTRIBUTE_SIZE);
+
+        if (!this->disk.submit_write(buffer_dest[buffer], request.blk)) return -1;
+      } else {
+        this->cache.store(request.block_no, request.blk);
+        free_buffers.push_back(buffer);
+      }
+    }
+
+    done.clear();
+  }
+
+  return ret;
+}
+
+// Gets length bytes of a file starting at offset, all of it by default. The
+// chain index finds the first block without following the FAT.
+std::string FS::read_cont_file(const dir_entry *entry, const unsigned long &offset, unsigned long length) {
+  std::vector<block_io> io;
+  std::vector<uint8_t> blocks;
+  unsigned index, start, last, count, window, skip;
+  unsigned long left;
+
+  std::string content;
+
+  if (offset >= entry->size) return content;
+
+  length = std::min<unsigned long>(length, entry->size - offset);
+
+  auto found = this->delayed.find(entry->first_blk);
+
+  if (found != this->delayed.end()) return found->second.content.substr(offset, length);
+
+  // Follow the chain in the FAT first so the blocks ahead of the reader are known.
+  const std::vector<unsigned> &chain = file_chain(entry);
+
+  start = offset / ENTRY_CONTENT_SIZE;
+  last = std::min<size_t>((offset + length + ENTRY_CONTENT_SIZE - 1) / ENTRY_CONTENT_SIZE, chain.size());
+  skip = offset % ENTRY_CONTENT_SIZE;
+
+  content.reserve(length);
+  left = length;
+  window = READAHEAD_MIN;
+
+  // Read a window at a time, the disk is already fetching the next window
+  // while this one is copied.
+  for (; start < last && left > 0; start += count) {
+    count = std::min(window, last - start);
+    window = std::min(window * 2, (unsigned)READAHEAD_MAX);
+
+    readahead(chain, start + count, std::min(window, last - start - count));
+
+    blocks.resize(count * BLOCK_SIZE);
+    io.resize(count);
+
+    for (index = 0; index < count; index++) {
+      io[index].block_no = chain[start + index];
+      io[index].blk = &blocks[index * BLOCK_SIZE];
+    }
+
+    if (read_blocks(io) != 0) return std::string();
+
+    for (index = 0; index < count && left > 0; index++) {
+      length = std::min<unsigned long>(left, ENTRY_CONTENT_SIZE - skip);
+      content.append((char *)io[index].blk + ENTRY_ATTRIBUTE_SIZE + skip, length);
+      left -= length;
+      skip = 0;
+    }
+  }
+
+  return content;
+}
+
+// Adds content to the end of a file. The last block is filled first and the
+// rest goes in new blocks linked after it, the chain index finds the last
+// block and is kept with the new blocks added.
+int FS::append_cont_file(dir_entry *entry, const std::string &content) {
+  uint8_t block[BLOCK_SIZE], attr[ENTRY_ATTRIBUTE_SIZE];
+  std::vector<unsigned> chain;
+  unsigned index, used, fill, tail;
+  int needed_blocks, found_blocks;
+  unsigned long rest;
+
+  if (content.empty()) return 0;
+
+  if ((uint64_t)entry->size + content.size() > UINT32_MAX) {
+    printf("%s would be too large.\n", entry->file_name);
+    return -1;
+  }
+
+  drop_dentry(entry->first_blk);
+
+  auto found = this->delayed.find(entry->first_blk);
+
+  // A delayed file only grows in memory.
+  if (found != this->delayed.end()) {
+    found->second.content.append(content);
+    found->second.entry.size += content.size();
+    entry->size += content.size();
+    this->delayed_bytes += content.size();
+
+    return this->delayed_bytes > DELALLOC_MAX_BYTES ? flush_all_delayed() : 0;
+  }
+
+  file_chain(entry);
+
+  // Taken out of the index, set_fat would drop it when the last block changes.
+  chain = std::move(this->chains[entry->first_blk].blocks);
+  drop_chain(entry->first_blk);
+
+  if (chain.empty()) return -1;
+
+  tail = chain.back();
+  used = entry->size - (chain.size() - 1) * ENTRY_CONTENT_SIZE;
+  fill = std::min<unsigned long>(ENTRY_CONTENT_SIZE - used, content.size());
+  rest = content.size() - fill;
+  needed_blocks = rest > 0 ? calc_needed_blocks(rest) : 0;
+
+  std::vector<int> free_blocks(needed_blocks);
+
+  if (needed_blocks > 0 && (found_blocks = find_free_blocks(needed_blocks, &free_blocks[0], tail / ALLOC_GROUP_BLOCKS)) < needed_blocks) {
+    printf("Not enough free blocks to append to %s.\n", entry->file_name);
+    release_blocks(&free_blocks[0], found_blocks);
+    store_chain(entry->first_blk, std::move(chain));
+    return -1;
+  }
+
+  entry->size += content.size();
+
+  empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+  fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
+
+  // The last block gets the start of the content, and the new size when it's
+  // also the first block.
+  if (this->cache.read(tail, block) != 0) {
+    if (needed_blocks > 0) release_blocks(&free_blocks[0], needed_blocks);
+    return -1;
+  }
+
+  content.copy((char *)block + ENTRY_ATTRIBUTE_SIZE + used, fill);
+
+  if (tail == entry->first_blk) memcpy(block, attr, ENTRY_ATTRIBUTE_SIZE);
+
+  this->cache.write(tail, block);
+
+  if (tail != entry->first_blk) {
+    if (this->cache.read(entry->first_blk, block) != 0) return -1;
+
+    memcpy(block, attr, ENTRY_ATTRIBUTE_SIZE);
+    this->cache.write(entry->first_blk, block);
+  }
+
+  if (needed_blocks > 0) {
+    std::vector<uint8_t> blocks(needed_blocks * BLOCK_SIZE, 0);
+    std::vector<block_io> io(needed_blocks);
+
+    for (index = 0; index < (unsigned)needed_blocks; index++) {
+      memcpy(&blocks[index * BLOCK_SIZE], attr, ENTRY_ATTRIBUTE_SIZE);
+      content.copy((char *)&blocks[index * BLOCK_SIZE] + ENTRY_ATTRIBUTE_SIZE, ENTRY_CONTENT_SIZE, fill + index * ENTRY_CONTENT_SIZE);
+
+      io[index].block_no = free_blocks[index];
+      io[index].blk = &blocks[index * BLOCK_SIZE];
+
+      set_fat(free_blocks[index], index + 1 < (unsigned)needed_blocks ? free_blocks[index + 1] : FAT_EOF);
+      chain.push_back(free_blocks[index]);
+    }
+
+    set_fat(tail, free_blocks[0]);
+
+    this->cache.write_blocks(io);
+
+    update_fat();
+  }
+
+  store_chain(entry->first_blk, std::move(chain));
+
+  return 0;
+}
+
+// Splits up a string into a path_obj
+int FS::format_path(std::string &path_s, path_obj *path) {
+  // TODO: Handle error.
+  if (path_s.empty()) return 1;
+
+  std::string temp, entry_name;
+  int index;
+
+  if (path_s[0] == '/')
+    path->start = START_ROOT;
+  else
+    path->start = START_WDIR;
+
+  for (index = 0; index < path_s.size(); index++) {
+    if (index == 0 && path->start == START_ROOT) index++;
+
+    if (path_s[index] == '/') {
+      path->dirs.push_back(entry_name);
+      entry_name.clear();
+    } else {
+      temp = path_s[index];
+      entry_name.append(temp);
+    }
+  }
+
+  path->dirs.push_back(entry_name);
+  entry_name.clear();
+
+  path->end = path->dirs[path->dirs.size() - 1];
+  path->dirs.pop_back();
+
+  return 0;
+}
+
+// Calculates the amount of needed blocks for a file.
+int FS::calc_needed_blocks(const unsigned long &size) {
+  int count;
+
+  count = (size + ENTRY_CONTENT_SIZE - 1) / ENTRY_CONTENT_SIZE;
+
+  if (count == 0) count = 1;
+
+  return count;
+}
+
+FS::FS(const uint8_t &disk_backend, const unsigned &cache_capacity) : disk(disk_backend), cache(&disk, cache_capacity) {
+  this->alloc_policy = FS_ALLOC_POLICY;
+  this->fat_flush_interval = FAT_FLUSH_INTERVAL;
+  this->delayed_bytes = 0;
+  this->delayed_alloc = FS_DELAYED_ALLOC;
+  this->dentry_hits = this->dentry_misses = this->bloom_skips = 0;
+  std::cout << "FS::FS()... Creating file system\n";
+  load_fat();
+  this->working_dir = read_block_attr(ROOT_BLOCK);
+
+  if (mount_check != FSCK_NONE) fsck(mount_check == FSCK_REPAIR);
+}
+
+FS::~FS() {
+  flush_all_delayed();
+  flush_fat();
+
+  // Clean only once everything else is written.
+  if (this->has_superblock) write_superblock(SB_STATE_CLEAN);
+
+  this->disk.sync();
+  delete this->working_dir;
+}
+
+Disk *FS::get_disk() { return &this->disk; }
+
+BlockCache *FS::get_cache() { return &this->cache; }
+
+int32_t *FS::get_fat() {
+  load_whole_fat();
+
+  return this->fat.data();
+}
+
+uint32_t FS::get_working_dir_blk_index() { return this->working_dir->first_blk; }
+
+int FS::lookup(const uint32_t &dir_blk, const std::string &name) {
+  const dentry *child;
+
+  if ((child = resolve(dir_blk, name)) == nullptr) return -1;
+
+  return child->block;
+}
+// formats the disk, i.e., creates an empty file system. A size other than 0
+// resizes the disk file to size bytes first.
+int FS::format(const uint64_t &size) {
+  unsigned index, no_blocks;
+  std::vector<unsigned> data_blocks;
+
+  if (size != 0) {
+    no_blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+    // Room for the root, the FAT and at least one more block.
+    if (size / BLOCK_SIZE > FAT_MAX_BLOCKS || no_blocks < FAT_BLOCK + calc_fat_blocks(no_blocks) + 1) {
+      printf("Can't format a disk of %llu bytes.\n", (unsigned long long)size);
+      return -1;
+    }
+
+    if (this->disk.resize(no_blocks) != 0) return -1;
+  }
+
+  // Nothing on the disk is kept, the storage of every data block is released.
+  no_blocks = this->disk.get_no_blocks();
+  this->fat_blocks = calc_fat_blocks(no_blocks);
+
+  for (index = FAT_BLOCK + this->fat_blocks; index < no_blocks; index++) data_blocks.push_back(index);
+
+  this->cache.clear();
+  this->disk.discard(data_blocks);
+
+  fs_obj::directory_t root;
+  fs_obj::dir_entry root_attr;
+  root_attr.first_blk = ROOT_BLOCK;
+  root_attr.type = TYPE_DIR;
+  root_attr.access_rights = READ | WRITE;
+  strcpy(root_attr.file_name, "/");
+
+  root.attributes = root_attr;
+  fs_obj::create_dir(this, &root, nullptr);
+
+  // Create fat, the root, the superblock and the fat itself are taken.
+  this->fat.assign(no_blocks, FAT_FREE);
+
+  for (index = 0; index < FAT_BLOCK + this->fat_blocks; index++) this->fat[index] = FAT_EOF;
+
+  build_free_map();
+  this->no_free = no_blocks - FAT_BLOCK - this->fat_blocks;
+
+  for (std::unique_ptr<alloc_group> &group : this->groups) group->loaded = true;
+
+  this->chains.clear();
+  this->chain_lru.clear();
+  this->chain_tails.clear();
+  this->dir_indexes.clear();
+  this->dir_index_lru.clear();
+  this->dentries.clear();
+  this->dentry_lru.clear();
+  this->dentry_blocks.clear();
+  this->dentry_parents.clear();
+  this->delayed.clear();
+  this->delayed_bytes = 0;
+  this->fat_dirty.clear();
+
+  for (index = 0; index < this->fat_blocks; index++) this->fat_dirty.insert(index);
+
+  flush_fat();
+
+  this->has_superblock = true;
+  write_superblock(SB_STATE_DIRTY);
+
+  delete this->working_dir;
+  this->working_dir = read_block_attr(ROOT_BLOCK);
+
+  return 0;
+}
+
+// create <filepath> creates a new file on the disk, the data content is
+// written on the following rows (ended with an empty row)
+int FS::create(std::string filepath) {
+  std::string buffer;
+  std::string input;
+  int needed_files, index, j;
+
+  uint8_t block[BLOCK_SIZE];
+  uint8_t cell;
+  uint32_t val;
+
+  path_obj path;
+
+  while (std::getline(std::cin, buffer) && !buffer.empty()) {
+    input.append(buffer);
+    input.append("\n");
+  }
+
+  // Waiting for the content isn't part of the operation.
+  OpScope scope(&this->ops[FS_OP_CREATE], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+
+  // TODO: check if disk is full.
+
+  dir_entry file;
+
+  if (format_path(filepath, &path) != 0) {
+    printf("%s is not a valid path.\n", filepath.c_str());
+    return 0;
+  }
+
+  // TODO: Check if works with longer paths.
+  dir_entry *parent;
+  if ((parent = follow_path(&path)) == nullptr) {
+    printf("Path: %s doesnt exist\n", filepath.c_str());
+    return 0;
+  }
+
+  std::cout << parent->first_blk << std::endl;
+
+  // TODO: give reason.
+  if (parent == nullptr) return 0;
 
   for (index = 0; index < 56; index++)
     if (index < filepath.size()) {
@@ -605,289 +1886,1131 @@ int FS::create(std::string filepath) {
     } else
       file.file_name[index] = 0;
 
-  file.size = input.size();
-  file.type = TYPE_FILE;
-  file.access_rights = WRITE + READ;
+  file.size = input.size();
+  file.type = TYPE_FILE;
+  file.access_rights = WRITE + READ;
+
+  this->create_dir_entry(&file, input, parent);
+
+  if (parent != this->working_dir) delete parent;
+
+  return 0;
+}
+
+// cat <filepath> reads the content of a file and prints it on the screen
+int FS::cat(std::string filepath) {
+  OpScope scope(&this->ops[FS_OP_CAT], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  path_obj path;
+  dir_entry *parent;
+  dir_entry *file;
+
+  std::string content;
+
+  if (format_path(filepath, &path) != 0) {
+    printf("%s is not a valid path.\n", filepath.c_str());
+    return 0;
+  }
+
+  // TODO: give reason.
+  if ((parent = follow_path(&path)) == nullptr) {
+    printf("Couldn't follow path\n");
+    return 0;
+  }
+
+  printf("%s\n", parent->file_name);
+
+  if ((file = get_child(parent, path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath.c_str());
+  } else if (file->type == TYPE_DIR) {
+    printf(
+        "Expected entry of type 'file', but the given path leads to a "
+        "directory.\n");
+  } else {
+    content = read_cont_file(file);
+
+    std::cout << content << std::endl;
+  }
+
+  delete file;
+
+  if (parent != this->working_dir) delete parent;
+
+  return 0;
+}
+
+// ls lists the content in the currect directory (files and sub-directories)
+int FS::ls() {
+  OpScope scope(&this->ops[FS_OP_LS], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  std::vector<dir_child> children;
+
+  // The children have the attributes, the entries' blocks aren't read.
+  dir_children(this->working_dir->first_blk, children);
+
+  printf("%15s |%10s |%7s\n", "Name", "Size", "Dir");
+
+  for (const dir_child &child : children) printf("%15s |%10d |%7d\n", child.file_name, child.size, child.type);
+
+  return 0;
+}
+
+// cp <sourcepath> <destpath> makes an exact copy of the file
+// <sourcepath> to a new file <destpath>
+int FS::cp(std::string sourcepath, std::string destpath) {
+  OpScope scope(&this->ops[FS_OP_CP], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  // Init variables
+  path_obj src_path, dest_path;
+  dir_entry *src_entry, *src_entry_parent, *dest_entry, *dest_entry_parent;
+  std::vector<unsigned> src_blocks;
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  int index, needed_blocks, found_blocks;
+  dir_child child;
+
+  // Validate input
+  if (format_path(sourcepath, &src_path) != 0) {
+    printf("%s is not a valid path.\n", sourcepath.c_str());
+    return 0;
+  }
+
+  if (format_path(destpath, &dest_path) != 0) {
+    printf("%s is not a valid path.\n", destpath.c_str());
+    return 0;
+  }
+
+  if ((src_entry_parent = follow_path(&src_path)) == nullptr) {
+    printf("%s doesn't exist.\n", sourcepath.c_str());
+    return 0;
+  }
+
+  if ((src_entry = get_child(src_entry_parent, src_path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", sourcepath.c_str());
+    return 0;
+  }
+
+  if (src_entry->type == TYPE_DIR) {
+    printf("%s is a directory, expected a file.\n", sourcepath.c_str());
+    return 0;
+  }
+
+  if ((dest_entry_parent = follow_path(&dest_path)) == nullptr) {
+    printf("%s doesn't exist.\n", destpath.c_str());
+    return 0;
+  }
+
+  if ((dest_entry = get_child(dest_entry_parent, dest_path.end)) != nullptr) {
+    printf("%s already exist.\n", destpath.c_str());
+    return 0;
+  }
+
+  dest_entry = new dir_entry;
+
+  // copy attributes
+  strcpy(dest_entry->file_name, dest_path.end.c_str());
+  dest_entry->size = src_entry->size;
+  dest_entry->first_blk = src_entry->first_blk;
+  dest_entry->type = src_entry->type;
+  dest_entry->access_rights = src_entry->access_rights;
+
+  // copy content block by block, without going through a string
+  if (flush_delayed(src_entry) != 0) {
+    printf("Couldn't write %s.\n", sourcepath.c_str());
+    delete dest_entry;
+    return 0;
+  }
+
+  src_blocks = file_chain(src_entry);
+  needed_blocks = src_blocks.size();
+
+  std::vector<int> dest_blocks(needed_blocks);
+
+  if (needed_blocks == 0 || (found_blocks = find_free_blocks(needed_blocks, &dest_blocks[0], dest_entry_parent->first_blk / ALLOC_GROUP_BLOCKS)) < needed_blocks) {
+    printf("Not enough free blocks to copy %s.\n", sourcepath.c_str());
+
+    if (needed_blocks > 0) release_blocks(&dest_blocks[0], found_blocks);
+  } else {
+    dest_entry->first_blk = dest_blocks[0];
+
+    empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+    fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, dest_entry);
+
+    if (copy_blocks(src_blocks, &dest_blocks[0], attr) == 0) {
+      for (index = 0; index < needed_blocks; index++) set_fat(dest_blocks[index], index + 1 < needed_blocks ? dest_blocks[index + 1] : FAT_EOF);
+
+      update_fat();
+
+      strncpy(child.file_name, dest_entry->file_name, 56);
+      child.index = dest_entry->first_blk;
+      child.size = dest_entry->size;
+      child.type = dest_entry->type;
+      child.access_rights = dest_entry->access_rights;
+      update_dir_content(dest_entry_parent, &child);
+    } else {
+      release_blocks(&dest_blocks[0], needed_blocks);
+    }
+  }
+
+  // free mem
+  delete src_entry;
+  delete dest_entry;
+
+  if (src_entry_parent != this->working_dir) delete src_entry_parent;
+
+  if (dest_entry_parent != this->working_dir) delete dest_entry_parent;
+
+  return 0;
+}
+
+// mv <sourcepath> <destpath> renames the file <sourcepath> to the name
+// <destpath>, or moves the file <sourcepath> to the directory <destpath> (if
+// dest is a directory)
+int FS::mv(std::string sourcepath, std::string destpath) {
+  std::cout << "FS::mv(" << sourcepath << "," << destpath << ")\n";
+  return 0;
+}
+
+// rm <filepath> removes / deletes the file <filepath>
+int FS::rm(std::string filepath) {
+  OpScope scope(&this->ops[FS_OP_RM], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  path_obj path;
+  dir_entry *parent, *entry;
+  int next_fat, current_fat;
+  dir_child entry_child;
+  std::vector<unsigned> freed;
+
+  if (format_path(filepath, &path) != 0) {
+    printf("%s is not a valid path.\n", filepath.c_str());
+    return 0;
+  }
+
+  if ((parent = follow_path(&path)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath.c_str());
+    return 0;
+  }
+
+  if ((entry = get_child(parent, path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath.c_str());
+    return 0;
+  }
+
+  // delete fat index from fat table.
+  current_fat = entry->first_blk;
+
+  printf("%s\n", entry->file_name);
+
+  // The name goes first, no record on the disk points at freed blocks.
+  for (int i = 0; i < 56; i++) entry_child.file_name[i] = entry->file_name[i];
+
+  update_dir_content(parent, &entry_child, REMOVE_DIR_CHILD);
+
+  // A file that was never flushed only gives back the block it reserved.
+  if (this->delayed.count(current_fat) != 0) {
+    drop_delayed(current_fat);
+    current_fat = FAT_EOF;
+  }
+
+  while (current_fat != FAT_EOF) {
+    printf("%d\n", current_fat);
+    next_fat = fat_entry(current_fat);
+    set_fat(current_fat, FAT_FREE);
+    freed.push_back(current_fat);
+    current_fat = next_fat;
+
+    printf("%d\n", current_fat);
+  }
+
+  update_fat();
+
+  // The freed blocks give their storage back to the host.
+  for (unsigned block : freed) this->cache.invalidate(block);
+
+  this->disk.discard(freed);
+
+  printf("%d\n", current_fat);
+
+  printf("%d\n", current_fat);
+
+  return 0;
+}
+
+// append <filepath1> <filepath2> appends the contents of file <filepath1> to
+// the end of file <filepath2>. The file <filepath1> is unchanged.
+int FS::append(std::string filepath1, std::string filepath2) {
+  OpScope scope(&this->ops[FS_OP_APPEND], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  path_obj src_path, dest_path;
+  dir_entry *src_entry, *src_entry_parent, *dest_entry, *dest_entry_parent;
+
+  if (format_path(filepath1, &src_path) != 0) {
+    printf("%s is not a valid path.\n", filepath1.c_str());
+    return 0;
+  }
+
+  if (format_path(filepath2, &dest_path) != 0) {
+    printf("%s is not a valid path.\n", filepath2.c_str());
+    return 0;
+  }
+
+  if ((src_entry_parent = follow_path(&src_path)) == nullptr || (src_entry = get_child(src_entry_parent, src_path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath1.c_str());
+    return 0;
+  }
+
+  if ((dest_entry_parent = follow_path(&dest_path)) == nullptr || (dest_entry = get_child(dest_entry_parent, dest_path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath2.c_str());
+    return 0;
+  }
+
+  if (src_entry->type == TYPE_DIR || dest_entry->type == TYPE_DIR)
+    printf("Expected two files.\n");
+  else if (append_cont_file(dest_entry, read_cont_file(src_entry)) == 0)
+    update_child_attr(dest_entry_parent->first_blk, dest_entry);
+
+  delete src_entry;
+  delete dest_entry;
+
+  if (src_entry_parent != this->working_dir) delete src_entry_parent;
+
+  if (dest_entry_parent != this->working_dir) delete dest_entry_parent;
+
+  return 0;
+}
+
+// mkdir <dirpath> creates a new sub-directory with the name <dirpath>
+// in the current directory
+int FS::mkdir(std::string dirpath) {
+  OpScope scope(&this->ops[FS_OP_MKDIR], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  dir_entry directory, *parent;
+  path_obj path;
+  char temp[56];
+
+  if (format_path(dirpath, &path) != 0) {
+    printf("%s is not a valid path.\n", dirpath.c_str());
+    return 0;
+  }
+
+  if ((parent = follow_path(&path)) == nullptr) {
+    printf("%s doesn't exist.\n", dirpath.c_str());
+    return 0;
+  }
+
+  printf("End: %s\nStart: %d\n", path.end.c_str(), path.start);
+
+  for (int index = 0; index < 56; index++) {
+    if (index < path.end.size())
+      directory.file_name[index] = path.end[index];
+    else
+      directory.file_name[index] = 0x00;
+  }
+
+  directory.size = 0;
+  directory.access_rights = READ | WRITE;
+  directory.type = TYPE_DIR;
+
+  create_dir_entry(&directory, "", parent);
+
+  if (parent != this->working_dir) delete parent;
+
+  return 0;
+}
+
+// cd <dirpath> changes the current (working) directory to the directory named
+// <dirpath>
+int FS::cd(std::string dirpath) {
+  OpScope scope(&this->ops[FS_OP_CD], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  dir_entry *directory, *parent;
+  path_obj path;
+  char temp[56];
+
+  if (format_path(dirpath, &path) != 0) {
+    printf("%s is not a valid path.\n", dirpath.c_str());
+    return 0;
+  }
+
+  if ((parent = follow_path(&path)) == nullptr) {
+    printf("%s doesn't exist.\n", dirpath.c_str());
+    return 0;
+  }
+
+  if ((directory = get_child(parent, path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", dirpath.c_str());
+    return 0;
+  }
+
+  if (directory->type == TYPE_FILE) {
+    printf("Given path leads to a file.\n");
+    return 0;
+  }
+
+  delete this->working_dir;
+  this->working_dir = directory;
+
+  printf("Current directory: %s\n", directory->file_name);
+
+  return 0;
+}
+
+// pwd prints the full path, i.e., from the root directory, to the current
+// directory, including the currect directory name
+int FS::pwd() {
+  std::cout << "FS::pwd()\n";
+  return 0;
+}
+
+// chmod <accessrights> <filepath> changes the access rights for the
+// file <filepath> to <accessrights>.
+int FS::chmod(std::string accessrights, std::string filepath) {
+  std::cout << "FS::chmod(" << accessrights << "," << filepath << ")\n";
+  return 0;
+}
+
+// sync writes the FAT and every dirty block to the disk file
+int FS::sync() {
+  int ret;
+
+  ret = flush_all_delayed();
+
+  if (flush_fat() != 0) ret = -1;
+
+  return this->disk.sync() != 0 ? -1 : ret;
+}
+
+// extents [filepath] lists how many extents, runs of adjacent blocks, every
+// entry in the current directory uses, or the extents of one file
+int FS::extents(std::string filepath) {
+  std::vector<dir_child *> children;
+  std::vector<extent> file_extents;
+  dir_entry *parent, *entry;
+  path_obj path;
+
+  if (filepath.empty()) {
+    children = read_cont_dir(this->working_dir);
+
+    printf("%15s |%10s |%8s\n", "Name", "Blocks", "Extents");
+
+    for (dir_child *child : children) {
+      if ((entry = read_block_attr(child->index)) != nullptr && flush_delayed(entry) == 0) {
+        std::vector<unsigned> chain = file_chain(entry);
+        printf("%15s |%10zu |%8zu\n", entry->file_name, chain.size(), chain_extents(chain).size());
+        delete entry;
+      }
+
+      delete child;
+    }
+
+    return 0;
+  }
+
+  if (format_path(filepath, &path) != 0) {
+    printf("%s is not a valid path.\n", filepath.c_str());
+    return 0;
+  }
+
+  if ((parent = follow_path(&path)) == nullptr || (entry = get_child(parent, path.end)) == nullptr) {
+    printf("%s doesn't exist.\n", filepath.c_str());
+    return 0;
+  }
+
+  if (flush_delayed(entry) != 0) {
+    delete entry;
+    return 0;
+  }
+
+  file_extents = chain_extents(file_chain(entry));
+
+  printf("%s: %zu extents\n", entry->file_name, file_extents.size());
+
+  for (const extent &ext : file_extents) printf("%10u |%10u blocks\n", ext.start, ext.length);
+
+  delete entry;
+
+  if (parent != this->working_dir) delete parent;
+
+  return 0;
+}
+
+// Collects every file below dir, directories are only visited once.
+void FS::walk_files(const dir_entry *dir, std::vector<file_ref> &files, std::set<unsigned> &seen) {
+  std::vector<dir_child *> children;
+  dir_entry *entry;
+  file_ref file;
+
+  if (!seen.insert(dir->first_blk).second) return;
+
+  children = read_cont_dir(dir);
+
+  for (dir_child *child : children) {
+    if ((entry = read_block_attr(child->index)) != nullptr) {
+      if (entry->type == TYPE_DIR) {
+        walk_files(entry, files, seen);
+      } else {
+        file.entry = *entry;
+        file.parent_blk = dir->first_blk;
+        files.push_back(file);
+      }
+
+      delete entry;
+    }
+
+    delete child;
+  }
+}
+
+// Prints how many of the files are split in several extents.
+void FS::print_fragmentation(const char *when, std::vector<file_ref> &files) {
+  unsigned fragmented, extents, count;
+
+  fragmented = 0;
+  extents = 0;
+
+  for (file_ref &file : files) {
+    count = chain_extents(file_chain(&file.entry)).size();
+    extents += count;
+
+    if (count > 1) fragmented++;
+  }
+
+  printf("%s: %zu files, %u fragmented, %u extents\n", when, files.size(), fragmented, extents);
+}
+
+// Copies a file to a free extent long enough for all of it, links the new
+// blocks in the FAT, points its directory at them and frees the old ones.
+// Returns -1 if there is no such extent.
+int FS::move_file(file_ref &file, const std::vector<unsigned> &chain) {
+  uint8_t attr[ENTRY_ATTRIBUTE_SIZE];
+  std::vector<unsigned> freed(chain);
+  std::vector<int> blocks(chain.size());
+  unsigned index, count, no_groups;
+  int found;
+  dir_entry *parent;
+  dir_child child;
+
+  count = chain.size();
+  no_groups = this->groups.size();
+  found = 0;
+
+  // Only a single extent in one group will do, the split allocation
+  // find_free_blocks falls back to isn't tried.
+  for (index = 0; index < no_groups && found == 0; index++)
+    found = take_extent(*this->groups[(file.entry.first_blk / ALLOC_GROUP_BLOCKS + index) % no_groups], count, blocks.data(), false);
+
+  if (found < (int)count) {
+    release_blocks(blocks.data(), found);
+    return -1;
+  }
+
+  file.entry.first_blk = blocks[0];
+
+  empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+  fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, &file.entry);
+
+  if (copy_blocks(chain, blocks.data(), attr) != 0) {
+    file.entry.first_blk = chain[0];
+    release_blocks(blocks.data(), count);
+    return -1;
+  }
+
+  for (index = 0; index < count; index++) set_fat(blocks[index], index + 1 < count ? blocks[index + 1] : FAT_EOF);
+
+  // The whole chain is replaced.
+  drop_chain(chain[0]);
+
+  parent = file.parent_blk == this->working_dir->first_blk ? this->working_dir : read_block_attr(file.parent_blk);
+
+  if (parent != nullptr) {
+    strncpy(child.file_name, file.entry.file_name, 56);
+    child.index = blocks[0];
+    update_dir_content(parent, &child, MOVE_DIR_CHILD);
+
+    if (parent != this->working_dir) delete parent;
+  }
+
+  for (unsigned block : freed) {
+    set_fat(block, FAT_FREE);
+    this->cache.invalidate(block);
+  }
+
+  update_fat();
+
+  this->disk.discard(freed);
+
+  return 0;
+}
+
+// defrag [blocks] moves every file that is split in several extents to a
+// free extent long enough for all of it. With a budget it stops once it has
+// moved that many blocks, so it can run a bit at a time
+int FS::defrag(const unsigned &max_blocks) {
+  OpScope scope(&this->ops[FS_OP_DEFRAG], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  std::vector<file_ref> files;
+  std::set<unsigned> seen;
+  unsigned moved_files, moved_blocks, skipped;
+  dir_entry *root;
+
+  // Delayed files get their blocks first, there's nothing to move otherwise.
+  flush_all_delayed();
+
+  if ((root = read_block_attr(ROOT_BLOCK)) == nullptr) return -1;
+
+  walk_files(root, files, seen);
+  delete root;
+
+  print_fragmentation("Before", files);
+
+  moved_files = 0;
+  moved_blocks = 0;
+  skipped = 0;
+
+  for (file_ref &file : files) {
+    if (max_blocks != 0 && moved_blocks >= max_blocks) break;
+
+    std::vector<unsigned> chain = file_chain(&file.entry);
+
+    if (chain_extents(chain).size() <= 1) continue;
+
+    if (move_file(file, chain) != 0) {
+      skipped++;
+      continue;
+    }
 
-  this->create_dir_entry(&file, input, parent);
+    moved_files++;
+    moved_blocks += chain.size();
+  }
 
-  if (parent != this->working_dir) delete parent;
+  printf("Moved %u files, %u blocks", moved_files, moved_blocks);
+
+  if (skipped > 0) printf(", %u without a free extent long enough", skipped);
+
+  printf("\n");
+
+  print_fragmentation("After", files);
 
   return 0;
 }
 
-// cat <filepath> reads the content of a file and prints it on the screen
-int FS::cat(std::string filepath) {
-  path_obj path;
-  dir_entry *parent;
-  dir_entry *file;
+// Runs fn over [0, count) split in ranges, one per thread, with at least
+// min_per_thread items in every range. Returns how many threads ran.
+static size_t parallel_for(const size_t &count, const size_t &min_per_thread, const std::function<void(size_t, size_t)> &fn) {
+  std::vector<std::thread> threads;
+  size_t index, no_threads, begin, end;
 
-  std::string content;
+  no_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count / min_per_thread);
 
-  if (format_path(filepath, &path) != 0) {
-    printf("%s is not a valid path.\n", filepath.c_str());
-    return 0;
+  if (no_threads <= 1) {
+    fn(0, count);
+    return 1;
   }
 
-  // TODO: give reason.
-  if ((parent = follow_path(&path)) == nullptr) {
-    printf("Couldn't follow path\n");
-    return 0;
+  for (index = 0; index < no_threads; index++) {
+    begin = count * index / no_threads;
+    end = count * (index + 1) / no_threads;
+    threads.push_back(std::thread(fn, begin, end));
   }
 
-  printf("%s\n", parent->file_name);
+  for (std::thread &thread : threads) thread.join();
 
-  file = get_child(parent, path.end);
+  return no_threads;
+}
 
-  // TODO: give reason
-  if (file->type == TYPE_DIR) {
-    printf(
-        "Expected entry of type 'file', but the given path leads to a "
-        "directory.\n");
-    return 0;
+// Collects every entry below dir, directories too, and looks for names found
+// twice in a directory and for children whose stored hash, filter bits or
+// attributes don't match. With repair the later names are renamed and the
+// directory rewritten.
+void FS::scan_dir(const dir_entry *dir, std::vector<file_ref> &entries, std::set<unsigned> &seen, unsigned &duplicates, unsigned &bad_records,
+                  const bool &repair) {
+  std::vector<dir_child *> children;
+  std::set<std::string> names;
+  std::vector<dir_entry> subdirs;
+  uint8_t bloom[DIR_BLOOM_SIZE], attr[ENTRY_ATTRIBUTE_SIZE];
+  const uint8_t *root;
+  dir_entry *entry, *parent;
+  dir_node node;
+  bool rewrite;
+  file_ref file;
+
+  if (!seen.insert(dir->first_blk).second) return;
+
+  if ((root = this->cache.read_ptr(dir->first_blk)) == nullptr) return;
+
+  memcpy(bloom, root + ENTRY_ATTRIBUTE_SIZE + N_BLOOM_OFFSET, DIR_BLOOM_SIZE);
+
+  children = read_cont_dir(dir);
+  rewrite = false;
+
+  for (dir_child *child : children) {
+    std::string name(child->file_name, strnlen(child->file_name, 56)), base;
+    bool child_renamed = false;
+
+    if (child->hash != codec::name_hash(child->file_name)) {
+      bad_records++;
+      printf("Wrong name hash for %s in directory %u\n", name.c_str(), dir->first_blk);
+      rewrite = rewrite || repair;
+    }
+
+    // The name couldn't be found.
+    if (!codec::bloom_test(bloom, codec::name_hash(child->file_name))) {
+      bad_records++;
+      printf("%s is missing from the filter of directory %u\n", name.c_str(), dir->first_blk);
+      rewrite = rewrite || repair;
+    }
+
+    if (!names.insert(name).second) {
+      duplicates++;
+      printf("Duplicate name %s in directory %u\n", name.c_str(), dir->first_blk);
+
+      if (repair) {
+        base = name.substr(0, 48);
+
+        for (unsigned copy = 1; !names.insert(name = base + "~" + std::to_string(copy)).second; copy++)
+          ;
+
+        memset(child->file_name, 0, 56);
+        memcpy(child->file_name, name.c_str(), name.size());
+        rewrite = child_renamed = true;
+      }
+    }
+
+    if ((entry = read_block_attr(child->index)) == nullptr) continue;
+
+    if (child_renamed) {
+      memcpy(entry->file_name, child->file_name, 56);
+      rewrite_attr(entry);
+    }
+
+    if (child->size != entry->size || child->type != entry->type || child->access_rights != entry->access_rights) {
+      bad_records++;
+      printf("The listing of %s in directory %u doesn't match its attributes\n", name.c_str(), dir->first_blk);
+      child->size = entry->size;
+      child->type = entry->type;
+      child->access_rights = entry->access_rights;
+      rewrite = rewrite || repair;
+    }
+
+    if (entry->type == TYPE_DIR && dir_parent(entry->first_blk) != dir->first_blk) {
+      bad_records++;
+      printf("Directory %s doesn't point back at directory %u\n", name.c_str(), dir->first_blk);
+
+      if (repair && read_node(entry->first_blk, node) == 0) {
+        empty_array(attr, ENTRY_ATTRIBUTE_SIZE);
+        fill_attr_array(attr, ENTRY_ATTRIBUTE_SIZE, entry);
+        node.parent = dir->first_blk;
+        write_node(node, attr);
+      }
+    }
+
+    // The name the directory has, the entry's block may be the broken one.
+    file.entry = *entry;
+    memcpy(file.entry.file_name, child->file_name, 56);
+    file.parent_blk = dir->first_blk;
+    entries.push_back(file);
+
+    if (entry->type == TYPE_DIR) subdirs.push_back(*entry);
+
+    delete entry;
   }
 
-  content = read_cont_file(file);
+  if (rewrite) {
+    parent = dir->first_blk == this->working_dir->first_blk ? this->working_dir : new dir_entry(*dir);
+    write_dir_content(parent, children);
 
-  std::cout << content << std::endl;
+    if (parent != this->working_dir) delete parent;
+  }
 
-  if (parent != this->working_dir) delete parent;
+  for (dir_child *child : children) delete child;
 
-  return 0;
+  for (dir_entry &subdir : subdirs) scan_dir(&subdir, entries, seen, duplicates, bad_records, repair);
 }
 
-// ls lists the content in the currect directory (files and sub-directories)
-int FS::ls() {
-  std::vector<dir_child *> children = read_cont_dir(this->working_dir);
+// Writes the attributes of an entry to its first block.
+void FS::rewrite_attr(const dir_entry *entry) {
+  uint8_t block[BLOCK_SIZE];
 
-  printf("%15s |%10s |%7s\n", "Name", "Size", "Dir");
+  drop_dentry(entry->first_blk);
 
-  for (const dir_child *child : children) {
-    dir_entry *child_info = read_block_attr(child->index);
-    printf("%15s |%10d |%7d\n", child_info->file_name, child_info->size, child_info->type);
-    delete child_info;
-    delete child;
-  }
+  if (this->cache.read(entry->first_blk, block) != 0) return;
 
-  return 0;
+  empty_array(block, ENTRY_ATTRIBUTE_SIZE);
+  codec::encode_attr(block, *entry);
+
+  this->cache.write(entry->first_blk, block);
 }
 
-// cp <sourcepath> <destpath> makes an exact copy of the file
-// <sourcepath> to a new file <destpath>
-int FS::cp(std::string sourcepath, std::string destpath) {
-  // Init variables
-  path_obj src_path, dest_path;
-  dir_entry *src_entry, *src_entry_parent, *dest_entry, *dest_entry_parent;
+// Removes an entry from the directory listing it.
+void FS::remove_child(const file_ref &file) {
+  dir_entry *parent;
+  dir_child child;
 
-  std::string content;
+  parent = file.parent_blk == this->working_dir->first_blk ? this->working_dir : read_block_attr(file.parent_blk);
 
-  // Validate input
-  if (format_path(sourcepath, &src_path) != 0) {
-    printf("%s is not a valid path.\n", sourcepath.c_str());
-    return 0;
-  }
+  if (parent == nullptr) return;
 
-  if (format_path(destpath, &dest_path) != 0) {
-    printf("%s is not a valid path.\n", destpath.c_str());
-    return 0;
-  }
+  memcpy(child.file_name, file.entry.file_name, 56);
+  update_dir_content(parent, &child, REMOVE_DIR_CHILD);
 
-  if ((src_entry_parent = follow_path(&src_path)) == nullptr) {
-    printf("%s doesn't exist.\n", sourcepath.c_str());
-    return 0;
-  }
+  if (parent != this->working_dir) delete parent;
+}
 
-  if ((src_entry = get_child(src_entry_parent, src_path.end)) == nullptr) {
-    printf("%s doesn't exist.\n", sourcepath.c_str());
-    return 0;
-  }
+// fsck [repair] checks that the directory tree and the FAT agree: orphaned
+// chains, blocks in more than one chain, files whose size doesn't match
+// their chain, names found twice in a directory and directory records that
+// don't match their entries. The chains are followed by several threads. With
+// repair the problems are fixed
+int FS::fsck(const bool &repair) {
+  OpScope scope(&this->ops[FS_OP_FSCK], &this->disk.get_stats()->reads, &this->disk.get_stats()->writes);
+  StatsTimer timer;
+  std::vector<file_ref> entries;
+  std::vector<unsigned> orphans;
+  std::set<unsigned> seen;
+  std::mutex orphans_lock;
+  unsigned no_blocks, system_blocks, files, dirs, used, duplicates, bad_records, cross_linked, broken, bad_sizes, orphan_chains;
+  size_t index, no_threads;
+  dir_entry *root;
+
+  // Delayed files get their blocks first, the FAT doesn't know them otherwise.
+  flush_all_delayed();
+
+  // The threads read the FAT as it is, all of it.
+  load_whole_fat();
+
+  duplicates = bad_records = 0;
+
+  // The tree is read through the cache by one thread.
+  if ((root = read_block_attr(ROOT_BLOCK)) == nullptr) return -1;
+
+  scan_dir(root, entries, seen, duplicates, bad_records, repair);
+  delete root;
+
+  no_blocks = this->fat.size();
+  system_blocks = FAT_BLOCK + this->fat_blocks;
+
+  // Every block is first owned by the lowest entry whose chain reaches it,
+  // the root, the superblock and the FAT own theirs.
+  std::vector<std::atomic<int32_t>> owner(no_blocks);
+  std::vector<chain_check> checks(entries.size());
+
+  no_threads = parallel_for(no_blocks, FSCK_MIN_PER_THREAD, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++) owner[block].store(block < system_blocks ? -1 : INT32_MAX, std::memory_order_relaxed);
+  });
+
+  // So do the other nodes of the root directory, chained after its block.
+  for (int32_t block = this->fat[ROOT_BLOCK], count = 0; block >= (int32_t)system_blocks && block < (int32_t)no_blocks && count < (int32_t)no_blocks;
+       block = this->fat[block], count++)
+    owner[block].store(-1, std::memory_order_relaxed);
+
+  // A directory's chain goes on to its end.
+  auto needed_blocks = [&](const dir_entry &entry) { return entry.type == TYPE_DIR ? no_blocks : (unsigned)calc_needed_blocks(entry.size); };
+
+  // Follows every chain up to what its size needs and claims its blocks.
+  no_threads = std::max(no_threads, parallel_for(entries.size(), FSCK_MIN_ENTRIES_PER_THREAD, [&](size_t begin, size_t end) {
+    for (size_t entry_index = begin; entry_index < end; entry_index++) {
+      chain_check &check = checks[entry_index];
+      unsigned needed = needed_blocks(entries[entry_index].entry);
+      int32_t block, current;
+
+      check.length = 0;
+      check.last = 0;
+      check.cross_at = -1;
+      check.broken = false;
+      check.longer = false;
+
+      block = entries[entry_index].entry.first_blk;
+
+      while (check.length < needed) {
+        if (block < (int32_t)system_blocks || block >= (int32_t)no_blocks || this->fat[block] == FAT_FREE ||
+            owner[block].load(std::memory_order_relaxed) == (int32_t)entry_index) {
+          check.broken = true;
+          break;
+        }
 
-  if (src_entry->type == TYPE_DIR) {
-    printf("%s is a directory, expected a file.\n", sourcepath.c_str());
-    return 0;
-  }
+        current = owner[block].load(std::memory_order_relaxed);
 
-  if ((dest_entry_parent = follow_path(&dest_path)) == nullptr) {
-    printf("%s doesn't exist.\n", destpath.c_str());
-    return 0;
-  }
+        while ((int32_t)entry_index < current && !owner[block].compare_exchange_weak(current, entry_index, std::memory_order_relaxed))
+          ;
 
-  if ((dest_entry = get_child(dest_entry_parent, dest_path.end)) != nullptr) {
-    printf("%s already exist.\n", destpath.c_str());
-    return 0;
+        check.last = block;
+        check.length++;
+
+        if ((block = this->fat[block]) == FAT_EOF) break;
+      }
+
+      check.longer = check.length == needed && !check.broken && block != FAT_EOF;
+    }
+  }));
+
+  // A shared block then goes to a chain that matches its entry's size before
+  // one that doesn't, the chains are claimed again with those ranks. The
+  // chain that doesn't match is the one cut by repair.
+  std::vector<int32_t> rank(entries.size());
+
+  for (index = 0; index < entries.size(); index++) {
+    const chain_check &check = checks[index];
+    bool matches = !check.broken && !check.longer && (entries[index].entry.type == TYPE_DIR || check.length == needed_blocks(entries[index].entry));
+
+    rank[index] = (matches ? 0 : entries.size()) + index;
   }
 
-  dest_entry = new dir_entry;
+  parallel_for(no_blocks, FSCK_MIN_PER_THREAD, [&](size_t begin, size_t end) {
+    for (size_t block = begin; block < end; block++)
+      if (owner[block].load(std::memory_order_relaxed) != -1) owner[block].store(INT32_MAX, std::memory_order_relaxed);
+  });
 
-  // copy attributes
-  strcpy(dest_entry->file_name, dest_path.end.c_str());
-  dest_entry->size = src_entry->size;
-  dest_entry->first_blk = src_entry->first_blk;
-  dest_entry->type = src_entry->type;
-  dest_entry->access_rights = src_entry->access_rights;
+  parallel_for(entries.size(), FSCK_MIN_ENTRIES_PER_THREAD, [&](size_t begin, size_t end) {
+    for (size_t entry_index = begin; entry_index < end; entry_index++) {
+      int32_t block = entries[entry_index].entry.first_blk, current;
 
-  // copy content
-  content = read_cont_file(src_entry);
+      for (unsigned ordinal = 0; ordinal < checks[entry_index].length; ordinal++, block = this->fat[block]) {
+        current = owner[block].load(std::memory_order_relaxed);
 
-  create_dir_entry(dest_entry, content, dest_entry_parent);
+        while (rank[entry_index] < current && !owner[block].compare_exchange_weak(current, rank[entry_index], std::memory_order_relaxed))
+          ;
+      }
+    }
+  });
+
+  // Finds where a chain runs into a block a chain ranked before it owns.
+  parallel_for(entries.size(), FSCK_MIN_ENTRIES_PER_THREAD, [&](size_t begin, size_t end) {
+    for (size_t entry_index = begin; entry_index < end; entry_index++) {
+      chain_check &check = checks[entry_index];
+      int32_t block = entries[entry_index].entry.first_blk;
+
+      for (unsigned ordinal = 0; ordinal < check.length; ordinal++, block = this->fat[block]) {
+        if (owner[block].load(std::memory_order_relaxed) != rank[entry_index]) {
+          check.cross_at = ordinal;
+          check.cross_block = block;
+          break;
+        }
+      }
+    }
+  });
 
-  // free mem
-  delete src_entry;
-  delete dest_entry;
+  // Blocks in use that no chain reached.
+  parallel_for(no_blocks, FSCK_MIN_PER_THREAD, [&](size_t begin, size_t end) {
+    std::vector<unsigned> found;
 
-  if (src_entry_parent != this->working_dir) delete src_entry_parent;
+    for (size_t block = begin; block < end; block++)
+      if (this->fat[block] != FAT_FREE && owner[block].load(std::memory_order_relaxed) == INT32_MAX) found.push_back(block);
 
-  if (dest_entry_parent != this->working_dir) delete dest_entry_parent;
+    std::lock_guard<std::mutex> guard(orphans_lock);
+    orphans.insert(orphans.end(), found.begin(), found.end());
+  });
 
-  return 0;
-}
+  std::sort(orphans.begin(), orphans.end());
 
-// mv <sourcepath> <destpath> renames the file <sourcepath> to the name
-// <destpath>, or moves the file <sourcepath> to the directory <destpath> (if
-// dest is a directory)
-int FS::mv(std::string sourcepath, std::string destpath) {
-  std::cout << "FS::mv(" << sourcepath << "," << destpath << ")\n";
-  return 0;
-}
+  // A chain starts at every orphaned block no other orphaned block links to.
+  std::vector<bool> linked(no_blocks, false);
 
-// rm <filepath> removes / deletes the file <filepath>
-int FS::rm(std::string filepath) {
-  path_obj path;
-  dir_entry *parent, *entry;
-  int next_fat, current_fat;
-  dir_child entry_child;
+  for (unsigned block : orphans)
+    if (this->fat[block] >= 0 && this->fat[block] < (int32_t)no_blocks) linked[this->fat[block]] = true;
 
-  if (format_path(filepath, &path) != 0) {
-    printf("%s is not a valid path.\n", filepath.c_str());
-    return 0;
+  orphan_chains = 0;
+
+  for (unsigned block : orphans)
+    if (!linked[block]) orphan_chains++;
+
+  files = dirs = used = cross_linked = broken = bad_sizes = 0;
+
+  for (index = 0; index < entries.size(); index++) {
+    const dir_entry &entry = entries[index].entry;
+    const chain_check &check = checks[index];
+
+    if (entry.type == TYPE_DIR)
+      dirs++;
+    else
+      files++;
+
+    used += check.length;
+
+    if (check.cross_at != -1) {
+      cross_linked++;
+      printf("Cross-linked: %s shares block %u with another entry\n", entry.file_name, check.cross_block);
+    } else if (check.broken) {
+      broken++;
+      printf("Broken chain: %s ends after %u of %u blocks\n", entry.file_name, check.length, needed_blocks(entry));
+    } else if (entry.type == TYPE_FILE && (check.length < needed_blocks(entry) || check.longer)) {
+      bad_sizes++;
+      printf("Size mismatch: %s has %u bytes but its chain is %s\n", entry.file_name, entry.size, check.longer ? "longer" : "shorter");
+    }
   }
 
-  if ((parent = follow_path(&path)) == nullptr) {
-    printf("%s doesn't exist.\n", filepath.c_str());
+  printf("Checked %u files, %u directories, %u blocks in use with %zu threads in %llu us\n", files, dirs, used + system_blocks, no_threads,
+         (unsigned long long)timer.elapsed_us());
+  printf("Orphaned: %zu blocks in %u chains\n", orphans.size(), orphan_chains);
+  printf("Cross-linked: %u, broken chains: %u, size mismatches: %u, duplicate names: %u, bad directory records: %u\n", cross_linked, broken, bad_sizes,
+         duplicates, bad_records);
+
+  if (orphans.empty() && cross_linked + broken + bad_sizes + duplicates + bad_records == 0) {
+    printf("No problems found\n");
     return 0;
   }
 
-  if ((entry = get_child(parent, path.end)) == nullptr) {
-    printf("%s doesn't exist.\n", filepath.c_str());
+  if (!repair) {
+    printf("Run fsck repair to fix them\n");
     return 0;
   }
 
-  // delete fat index from fat table.
-  current_fat = entry->first_blk;
+  // Orphaned blocks are freed, the tails of chains that are too long too.
+  for (unsigned block : orphans) {
+    set_fat(block, FAT_FREE);
+    this->cache.invalidate(block);
+  }
 
-  printf("%s\n", entry->file_name);
+  this->disk.discard(orphans);
 
-  while (current_fat != FAT_EOF) {
-    printf("%d\n", current_fat);
-    next_fat = this->fat[current_fat];
-    this->fat[current_fat] = FAT_FREE;
-    current_fat = next_fat;
+  // Chains end where they go wrong and sizes are cut to what's left.
+  for (index = 0; index < entries.size(); index++) {
+    dir_entry &entry = entries[index].entry;
+    const chain_check &check = checks[index];
+    unsigned length = check.length;
+    int32_t block;
 
-    printf("%d\n", current_fat);
-  }
+    if (check.cross_at != -1) length = check.cross_at;
 
-  update_fat();
+    if (length == 0 && (check.cross_at != -1 || check.broken)) {
+      remove_child(entries[index]);
+      continue;
+    }
 
-  printf("%d\n", current_fat);
+    if (check.cross_at > 0) {
+      block = entry.first_blk;
 
-  for (int i = 0; i < 56; i++) entry_child.file_name[i] = entry->file_name[i];
+      for (unsigned ordinal = 1; ordinal < length; ordinal++) block = this->fat[block];
 
-  printf("%d\n", current_fat);
+      set_fat(block, FAT_EOF);
+    } else if (check.broken || check.longer) {
+      set_fat(check.last, FAT_EOF);
+    }
 
-  update_dir_content(parent, &entry_child, REMOVE_DIR_CHILD);
+    // Cut in the middle, set_fat only sees the ends of an indexed chain.
+    if (check.cross_at > 0 || check.broken || check.longer) drop_chain(entry.first_blk);
+
+    if (entry.type == TYPE_FILE && length < needed_blocks(entry)) {
+      entry.size = std::min<uint32_t>(entry.size, length * ENTRY_CONTENT_SIZE);
+      rewrite_attr(&entry);
+      update_child_attr(entries[index].parent_blk, &entry);
+    }
+  }
+
+  update_fat();
+  flush_fat();
+
+  printf("Repaired\n");
 
   return 0;
 }
 
-// append <filepath1> <filepath2> appends the contents of file <filepath1> to
-// the end of file <filepath2>. The file <filepath1> is unchanged.
-int FS::append(std::string filepath1, std::string filepath2) {
-  std::cout << "FS::append(" << filepath1 << "," << filepath2 << ")\n";
-  return 0;
+// Prints the statistics of one kind of disk call.
+static void print_io_stats(const char *name, io_stats &io) {
+  printf("%10s |%8llu |%8llu |%12llu |%8llu |%8llu |%8llu\n", name, (unsigned long long)io.latency.get_count(), (unsigned long long)io.blocks,
+         (unsigned long long)io.blocks * BLOCK_SIZE, (unsigned long long)io.latency.get_avg_us(), (unsigned long long)io.latency.percentile(99),
+         (unsigned long long)io.latency.get_max_us());
 }
 
-// mkdir <dirpath> creates a new sub-directory with the name <dirpath>
-// in the current directory
-int FS::mkdir(std::string dirpath) {
-  dir_entry directory, *parent;
-  path_obj path;
-  char temp[56];
+// Prints the statistics of one kind of disk call as a JSON object.
+static void dump_io_stats(const char *name, io_stats &io) {
+  printf("\"%s\":{\"calls\":%llu,\"blocks\":%llu,\"bytes\":%llu,\"total_us\":%llu,\"max_us\":%llu,\"histogram_us\":%s}", name,
+         (unsigned long long)io.latency.get_count(), (unsigned long long)io.blocks, (unsigned long long)io.blocks * BLOCK_SIZE,
+         (unsigned long long)io.latency.get_total_us(), (unsigned long long)io.latency.get_max_us(), io.latency.to_json().c_str());
+}
 
-  if (format_path(dirpath, &path) != 0) {
-    printf("%s is not a valid path.\n", dirpath.c_str());
-    return 0;
-  }
+// df prints the size of the disk and how many of its blocks are used and
+// free, from the counts kept while the FAT changes
+int FS::df() {
+  unsigned no_blocks, no_free;
 
-  if ((parent = follow_path(&path)) == nullptr) {
-    printf("%s doesn't exist.\n", dirpath.c_str());
-    return 0;
-  }
+  no_blocks = this->fat.size();
+  no_free = this->no_free;
 
-  printf("End: %s\nStart: %d\n", path.end.c_str(), path.start);
+  printf("%14s |%10s |%10s |%10s |%5s\n", "Size", "Blocks", "Used", "Free", "Use%");
+  printf("%14llu |%10u |%10u |%10u |%4u%%\n", (unsigned long long)no_blocks * BLOCK_SIZE, no_blocks, no_blocks - no_free, no_free,
+         no_blocks > 0 ? (unsigned)((uint64_t)(no_blocks - no_free) * 100 / no_blocks) : 0);
+  printf("Free space: %llu bytes\n", (unsigned long long)no_free * BLOCK_SIZE);
 
-  for (int index = 0; index < 56; index++) {
-    if (index < path.end.size())
-      directory.file_name[index] = path.end[index];
-    else
-      directory.file_name[index] = 0x00;
-  }
+  // Their blocks are only counted once they're flushed.
+  if (!this->delayed.empty()) printf("Delayed files: %zu, %lu bytes\n", this->delayed.size(), this->delayed_bytes);
 
-  directory.size = 0;
-  directory.access_rights = READ | WRITE;
-  directory.type = TYPE_DIR;
+  return 0;
+}
 
-  create_dir_entry(&directory, "", parent);
+// stats prints the I/O statistics of the disk and of every operation,
+// as one line of JSON when dump is set
+int FS::stats(const bool &dump) {
+  disk_stats *disk_stats = this->disk.get_stats();
+  unsigned no_free, no_extents;
+  int index;
 
-  if (parent != this->working_dir) delete parent;
+  no_free = 0;
+  no_extents = 0;
 
-  return 0;
-}
+  for (std::unique_ptr<alloc_group> &group : this->groups) {
+    std::lock_guard<std::mutex> guard(group->lock);
 
-// cd <dirpath> changes the current (working) directory to the directory named
-// <dirpath>
-int FS::cd(std::string dirpath) {
-  dir_entry *directory, *parent;
-  path_obj path;
-  char temp[56];
+    fill_group(*group);
 
-  if (format_path(dirpath, &path) != 0) {
-    printf("%s is not a valid path.\n", dirpath.c_str());
-    return 0;
+    no_free += group->free_map.get_no_free();
+    no_extents += group->free_map.get_no_extents();
   }
 
-  if ((parent = follow_path(&path)) == nullptr) {
-    printf("%s doesn't exist.\n", dirpath.c_str());
-    return 0;
-  }
+  if (dump) {
+    printf("{\"disk\":{");
+    dump_io_stats("read", disk_stats->reads);
+    printf(",");
+    dump_io_stats("write", disk_stats->writes);
+    printf(",");
+    dump_io_stats("sync", disk_stats->syncs);
+    printf(",");
+    dump_io_stats("discard", disk_stats->discards);
+    printf(",");
+    dump_io_stats("readahead", disk_stats->readaheads);
+    printf(",\"zero_fills\":%llu},", (unsigned long long)disk_stats->zero_fills);
+    printf("\"cache\":{\"hits\":%lu,\"misses\":%lu},", this->cache.get_hits(), this->cache.get_misses());
+    printf("\"free\":{\"blocks\":%u,\"extents\":%u,\"groups\":%zu},", no_free, no_extents, this->groups.size());
+    printf("\"delayed\":{\"files\":%zu,\"bytes\":%lu},", this->delayed.size(), this->delayed_bytes);
+    printf("\"names\":{\"hits\":%lu,\"misses\":%lu,\"filter_skips\":%lu},\"ops\":{", this->dentry_hits, this->dentry_misses, this->bloom_skips);
+
+    for (index = 0; index < FS_OP_COUNT; index++) {
+      op_stats &op = this->ops[index];
+      printf("%s\"%s\":{\"calls\":%llu,\"blocks_read\":%llu,\"blocks_written\":%llu,\"total_us\":%llu,\"max_us\":%llu,\"histogram_us\":%s}",
+             index > 0 ? "," : "", op_names[index], (unsigned long long)op.latency.get_count(), (unsigned long long)op.blocks_read,
+             (unsigned long long)op.blocks_written, (unsigned long long)op.latency.get_total_us(), (unsigned long long)op.latency.get_max_us(),
+             op.latency.to_json().c_str());
+    }
 
-  if ((directory = get_child(parent, path.end)) == nullptr) {
-    printf("%s doesn't exist.\n", dirpath.c_str());
-    return 0;
-  }
+    printf("}}\n");
 
-  if (directory->type == TYPE_FILE) {
-    printf("Given path leads to a file.\n");
     return 0;
   }
 
-  delete this->working_dir;
-  this->working_dir = directory;
-
-  printf("Current directory: %s\n", directory->file_name);
+  // Latencies are in microseconds, p99 is the upper bound of its bucket.
+  printf("%10s |%8s |%8s |%12s |%8s |%8s |%8s\n", "Disk", "Calls", "Blocks", "Bytes", "Avg us", "p99 us", "Max us");
+  print_io_stats("read", disk_stats->reads);
+  print_io_stats("write", disk_stats->writes);
+  print_io_stats("sync", disk_stats->syncs);
+  print_io_stats("discard", disk_stats->discards);
+  print_io_stats("readahead", disk_stats->readaheads);
+  printf("Zero-filled reads: %llu, cache hits: %lu, misses: %lu\n", (unsigned long long)disk_stats->zero_fills, this->cache.get_hits(),
+         this->cache.get_misses());
+  printf("Free blocks: %u in %u extents, %zu allocation groups\n", no_free, no_extents, this->groups.size());
+  printf("Delayed files: %zu, %lu bytes\n", this->delayed.size(), this->delayed_bytes);
+  printf("Names: %lu cached, %lu looked up, %lu not found by filters\n", this->dentry_hits, this->dentry_misses, this->bloom_skips);
+
+  printf("%10s |%8s |%8s |%8s |%8s |%8s |%8s\n", "Operation", "Calls", "Blk read", "Blk wrt", "Avg us", "p99 us", "Max us");
+
+  for (index = 0; index < FS_OP_COUNT; index++) {
+    op_stats &op = this->ops[index];
+    printf("%10s |%8llu |%8llu |%8llu |%8llu |%8llu |%8llu\n", op_names[index], (unsigned long long)op.latency.get_count(),
+           (unsigned long long)op.blocks_read, (unsigned long long)op.blocks_written, (unsigned long long)op.latency.get_avg_us(),
+           (unsigned long long)op.latency.percentile(99), (unsigned long long)op.latency.get_max_us());
+  }
 
   return 0;
 }
 
-// pwd prints the full path, i.e., from the root directory, to the current
-// directory, including the currect directory name
-int FS::pwd() {
-  std::cout << "FS::pwd()\n";
-  return 0;
-}
+// resets every statistic
+int FS::reset_stats() {
+  int index;
+
+  this->disk.reset_stats();
+  this->cache.reset_stats();
+  this->dentry_hits = this->dentry_misses = this->bloom_skips = 0;
+
+  for (index = 0; index < FS_OP_COUNT; index++) this->ops[index] = op_stats();
 
-// chmod <accessrights> <filepath> changes the access rights for the
-// file <filepath> to <accessrights>.
-int FS::chmod(std::string accessrights, std::string filepath) {
-  std::cout << "FS::chmod(" << accessrights << "," << filepath << ")\n";
   return 0;
 }
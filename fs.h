@@ -1,17 +1,57 @@
+#include <atomic>
 #include <cstdint>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "cache.h"
+#include "constants.h"
 #include "disk.h"
+#include "freemap.h"
+#include "stats.h"
 
 #ifndef __FS_H__
 #define __FS_H__
 
 #define ROOT_BLOCK 0
-#define FAT_BLOCK 1
+#define SUPER_BLOCK 1
+#define FAT_BLOCK 2
 #define FAT_FREE 0
 #define FAT_EOF -1
+// FAT entries are 4 bytes, the FAT takes as many blocks as the disk needs
+#define FAT_ENTRY_SIZE 4
+#define FAT_ENTRIES_PER_BLOCK (BLOCK_SIZE / FAT_ENTRY_SIZE)
+// changed FAT blocks are written after this many operations, or on sync
+#define FAT_FLUSH_INTERVAL 16
+// block numbers have to fit in a positive FAT entry
+#define FAT_MAX_BLOCKS 0x7fffffff
+
+// the superblock records the geometry of the file system and how many
+// blocks are free, its integers are little-endian at these offsets
+#define SB_MAGIC 0x42535346  // "FSSB" on the disk
+// 2: directory children hold the hash of their name
+// 3: directories are B+trees spanning several blocks
+// 4: the root of a directory holds a Bloom filter of its names
+// 5: directory children hold the size, type and access rights of the entry,
+//    the root of a directory the block of its parent
+#define SB_VERSION 5
+#define SB_MAGIC_OFFSET 0
+#define SB_VERSION_OFFSET 4
+#define SB_BLOCK_SIZE_OFFSET 8
+#define SB_NO_BLOCKS_OFFSET 12
+#define SB_FAT_FIRST_OFFSET 16
+#define SB_FAT_BLOCKS_OFFSET 20
+#define SB_FREE_BLOCKS_OFFSET 24
+#define SB_STATE_OFFSET 28
+// the state is dirty while the file system is mounted, the free block count
+// is only trusted when it was unmounted cleanly
+#define SB_STATE_DIRTY 0x00
+#define SB_STATE_CLEAN 0x01
 
 #define TYPE_FILE 0
 #define TYPE_DIR 1
@@ -22,16 +62,77 @@
 #define START_ROOT 0xff
 #define START_WDIR 0x00
 
-#define ENTRY_CONTENT_SIZE 4032
-#define ENTRY_ATTRIBUTE_SIZE 64
+#define ENTRY_CONTENT_SIZE 4024
+#define ENTRY_ATTRIBUTE_SIZE 72
 
 #define REMOVE_DIR_CHILD 0x00
+#define MOVE_DIR_CHILD 0x01  // the child keeps its name and gets a new index
 #define ADD_DIR_CHILD 0xff
 
+// how free blocks are picked for a file, every policy looks for a single
+// free extent first and falls back to the longest extents
+#define ALLOC_FIRST_FIT 0x00  // the lowest extent that is long enough
+#define ALLOC_NEXT_FIT 0x01   // the first long enough extent after the last allocation
+#define ALLOC_BEST_FIT 0x02   // the shortest extent that is long enough
+#define FS_ALLOC_POLICY ALLOC_BEST_FIT
+
+// the disk is split in allocation groups of this many blocks, 128 MiB, each
+// with a free space index and lock of its own
+#define ALLOC_GROUP_BLOCKS 32768
+
+// a file's chain is read a window of blocks at a time, the window doubles
+// after every read up to READAHEAD_MAX while the next one is prefetched
+#define READAHEAD_MIN 4
+#define READAHEAD_MAX 256
+
+// how many files keep the index of their chain at once
+#define CHAIN_INDEX_CAPACITY 64
+
+// how many directories keep their children indexed by name at once
+#define DIR_INDEX_CAPACITY 64
+
+// how many names resolved to their entry are kept at once
+#define DENTRY_CACHE_CAPACITY 1024
+
+// a directory is a B+tree of blocks keyed on the names of its children, its
+// first block is the root. Every block of the tree is in the directory's
+// chain, so it's freed and checked like the blocks of a file. Adding a child
+// needs a free block for each level that splits, at most this many
+#define DIR_MAX_DEPTH 8
+
+// new files only reserve their first block, their content stays in memory
+// and the rest of their blocks are chosen when they're flushed: on sync, or
+// when more than DELALLOC_MAX_BYTES are waiting. Only on a write-back disk,
+// the reserved block is free in the FAT on disk while the directory already
+// lists the file, after a crash it would be handed out again
+#define FS_DELAYED_ALLOC true
+#define DELALLOC_MAX_BYTES (16 * 1024 * 1024)
+
+// operations that keep statistics of their own
+#define FS_OP_CREATE 0
+#define FS_OP_CAT 1
+#define FS_OP_LS 2
+#define FS_OP_CP 3
+#define FS_OP_RM 4
+#define FS_OP_MKDIR 5
+#define FS_OP_CD 6
+#define FS_OP_APPEND 7
+#define FS_OP_DEFRAG 8
+#define FS_OP_FSCK 9
+#define FS_OP_COUNT 10
+
+// whether the file system is checked when it's mounted
+#define FSCK_NONE 0x00
+#define FSCK_CHECK 0x01
+#define FSCK_REPAIR 0x02
+// fsck only starts a thread for at least this many blocks, or entries
+#define FSCK_MIN_PER_THREAD 16384
+#define FSCK_MIN_ENTRIES_PER_THREAD 64
+
 struct dir_entry {
   char file_name[56];     // name of the file / sub-directory
   uint32_t size;          // size of the file in bytes
-  uint16_t first_blk;     // index in the FAT for the first block of the file
+  uint32_t first_blk;     // index in the FAT for the first block of the file
   uint8_t type;           // directory (1) or file (0)
   uint8_t access_rights;  // read (0x04), write (0x02), execute (0x01)
 };
@@ -44,18 +145,169 @@ struct path_obj {
 
 struct dir_child {
   char file_name[56];
-  uint16_t index;
+  uint32_t index;
+  uint32_t hash;  // hash of the name as read from the disk, written from the name
+  // copied from the attributes of the entry
+  uint32_t size;
+  uint8_t type;
+  uint8_t access_rights;
+};
+
+// one block of a directory's B+tree
+struct dir_node {
+  unsigned block;
+  bool leaf;
+  unsigned link;                 // the next leaf, 0 after the last, or the first subtree
+  std::vector<dir_child> items;  // children of a leaf, or the first name and block of every other subtree
+  unsigned parent = 0;                  // the directory listing this one, in its root
+  uint8_t bloom[DIR_BLOOM_SIZE] = {0};  // the names of the directory in its root
+};
+
+// the children of a directory as they're on the disk, found by the hash of
+// their name
+struct dir_index {
+  std::vector<dir_child> children;
+  std::unordered_multimap<uint32_t, unsigned> slots;  // name hash -> position in children
+  std::list<unsigned>::iterator recent;               // place in the recency list
+};
+
+// a name in a directory, by the directory's block
+struct dentry_key {
+  unsigned parent;
+  std::string name;
+
+  bool operator==(const dentry_key &other) const { return parent == other.parent && name == other.name; }
+};
+
+struct dentry_key_hash {
+  size_t operator()(const dentry_key &key) const { return std::hash<std::string>()(key.name) * 31 + key.parent; }
+};
+
+// the attributes of an entry, found by its name
+struct dentry {
+  bool missing;    // the directory has no entry by that name
+  unsigned block;  // the entry's first block
+  dir_entry attr;
+  std::list<const dentry_key *>::iterator recent;  // place in the recency list
+};
+
+typedef std::unordered_map<dentry_key, dentry, dentry_key_hash> dentry_map;
+
+// the index of one chain and its place among the others
+struct chain_index {
+  std::vector<unsigned> blocks;
+  std::list<unsigned>::iterator recent;  // place in the recency list
+};
+
+// run of adjacent blocks in a chain
+struct extent {
+  unsigned start;   // first block
+  unsigned length;  // number of blocks
+};
+
+struct superblock {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t block_size;   // bytes in a block
+  uint32_t no_blocks;    // blocks on the disk
+  uint32_t fat_first;    // first block of the FAT
+  uint32_t fat_blocks;   // blocks the FAT takes
+  uint32_t free_blocks;  // free blocks in the FAT
+  uint32_t state;        // clean or dirty
+};
+
+// a file found while walking the directory tree
+struct file_ref {
+  dir_entry entry;
+  unsigned parent_blk;  // first block of the directory listing it
+};
+
+// what fsck found following the chain of one entry
+struct chain_check {
+  unsigned length;  // blocks followed, up to what the size needs
+  unsigned last;    // the last block followed
+  int cross_at;     // first block, counted in the chain, owned by another entry, -1 if none
+  unsigned cross_block;  // that block's number
+  bool broken;      // ran into a free or invalid block
+  bool longer;      // goes on past what the size needs
+};
+
+// a file whose blocks haven't been chosen yet, its first block is reserved
+// in the free space bitmap until then
+struct delayed_file {
+  dir_entry entry;
+  std::string content;
+  unsigned parent_blk;  // first block of the directory listing it
+  bool reserved;        // whether the first block is still held for it
+};
+
+// blocks allocated together. Files go in the group of their directory and
+// new directories in the next group, so groups can be searched at the same
+// time and related files stay close. The free space bitmap of a group is
+// only built from the FAT when the group is first allocated from
+struct alloc_group {
+  unsigned first;    // first block of the group
+  unsigned length;   // blocks in the group
+  bool filled;       // whether free_map was built
+  bool loaded;       // whether its part of the FAT was read
+  FreeMap free_map;  // free blocks, counted from first
+  unsigned cursor;   // where next-fit looks first, counted from first
+  std::mutex lock;   // held while free_map, filled or cursor change
 };
 
 class FS {
  private:
+  static uint8_t mount_check;
   Disk disk;
+  BlockCache cache;
   dir_entry *working_dir;
-  // size of a FAT entry is 2 bytes
-  int16_t fat[BLOCK_SIZE / 2];
+  // one entry per block on the disk
+  std::vector<int32_t> fat;
+  unsigned fat_blocks;
+  std::set<unsigned> fat_dirty;  // FAT blocks, counted from FAT_BLOCK, with changed entries
+  std::mutex fat_lock;           // held while set_fat and flush_fat use fat and fat_dirty
+  unsigned fat_pending;          // operations that changed the FAT since it was written
+  unsigned fat_flush_interval;
+  // free blocks of the FAT by allocation group, kept in step by set_fat
+  std::vector<std::unique_ptr<alloc_group>> groups;
+  std::atomic<unsigned> no_free;  // free blocks in the FAT
+  bool has_superblock;            // whether the disk was formatted with one
+  std::atomic<unsigned> next_group;  // the group of the next new directory
+  uint8_t alloc_policy;
+  // the disk block of every block of a file by its first block, built when
+  // the file is read and dropped by set_fat when its chain changes
+  std::unordered_map<unsigned, chain_index> chains;
+  std::list<unsigned> chain_lru;  // most recently used chain first
+  std::unordered_map<unsigned, unsigned> chain_tails;  // last block -> first block of an indexed chain
+  // the children of directories by their block, dropped by set_fat when the
+  // block is freed and kept in step when a child is added or removed
+  std::unordered_map<unsigned, dir_index> dir_indexes;
+  std::list<unsigned> dir_index_lru;  // most recently used directory first
+  // the attributes of resolved names, and names found missing, dropped when
+  // the name is added, moved or removed, when the entry's first block is
+  // written or freed and when the directory's block is freed
+  dentry_map dentries;
+  std::list<const dentry_key *> dentry_lru;  // most recently used name first
+  std::unordered_map<unsigned, dentry_key> dentry_blocks;  // first block -> name of a cached entry
+  std::unordered_map<unsigned, unsigned> dentry_parents;   // directory block -> cached names in it
+  unsigned long dentry_hits, dentry_misses, bloom_skips;
+  // files with delayed allocation by their reserved first block
+  std::unordered_map<unsigned, delayed_file> delayed;
+  unsigned long delayed_bytes;
+  bool delayed_alloc;
+  op_stats ops[FS_OP_COUNT];
 
+  unsigned calc_fat_blocks(const unsigned &no_blocks);
   void load_fat();
+  void load_fat_group(alloc_group &group);
+  void load_whole_fat();
   void update_fat();
+  int flush_fat();
+  void build_free_map();
+  void fill_group(alloc_group &group);
+  int read_superblock(superblock &super);
+  int write_superblock(const uint32_t &state);
+  void set_fat(const unsigned &index, const int32_t &value);
   void empty_array(uint8_t *arr, const int &size);
   void fill_attr_array(uint8_t *attr, const int &size, dir_entry *entry);
 
@@ -63,30 +315,101 @@ class FS {
   dir_entry *get_child(const dir_entry *parent, const std::string &name);
   void create_dir_entry(struct dir_entry *entry, const std::string file_content, dir_entry *parent, const int &fat_index = -1);
   void update_dir_content(dir_entry *entry, dir_child *child, const uint8_t &task = ADD_DIR_CHILD);
+  void write_dir_content(dir_entry *entry, const std::vector<dir_child *> &children);
+  int read_node(const unsigned &block, dir_node &node);
+  void write_node(const dir_node &node, const uint8_t *attr);
+  int new_node(const unsigned &dir_blk, unsigned &block);
+  int insert_child(const unsigned &dir_blk, const unsigned &block, const dir_child &child, const uint8_t *attr, dir_child &split);
+  int btree_insert(const unsigned &dir_blk, const dir_child &child, const uint8_t *attr);
+  int find_leaf(const unsigned &dir_blk, const char *name, dir_node &leaf);
+  const dir_index &directory_index(const unsigned &block);
+  void store_dir_index(const unsigned &block, dir_index &&index);
+  void drop_dir_index(const unsigned &block);
+  int find_child(const unsigned &block, const char *name);
+  const dentry *resolve(const unsigned &parent_blk, const std::string &name);
+  dentry &store_dentry(dentry_key &&key, const bool &missing, const unsigned &block);
+  void erase_dentry(dentry_map::iterator found);
+  void drop_dentry(const unsigned &parent_blk, const char *name);
+  void drop_dentry(const unsigned &block);
+  void drop_dir_dentries(const unsigned &dir_blk);
+  unsigned dir_parent(const unsigned &dir_blk);
+  void update_child_attr(const unsigned &parent_blk, const dir_entry *entry);
+  void refill_bloom(const unsigned &dir_blk, const int &removed, dir_node &leaf, const uint8_t *attr);
 
   void write_block(uint8_t attr[ENTRY_ATTRIBUTE_SIZE], uint8_t cont[ENTRY_CONTENT_SIZE], unsigned block_no);
 
-  dir_entry *read_block_attr(uint16_t block_index);
+  dir_entry *read_block_attr(uint32_t block_index);
+
+  alloc_group &group_of(const unsigned &block) { return *this->groups[block / ALLOC_GROUP_BLOCKS]; }
+  // the FAT entry of a block, read with the rest of its group's part of the
+  // FAT the first time
+  int32_t fat_entry(const unsigned &block) {
+    alloc_group &group = group_of(block);
+
+    if (!group.loaded) load_fat_group(group);
+
+    return this->fat[block];
+  }
+  int find_extent(alloc_group &group, const unsigned &length);
+  int take_extent(alloc_group &group, const unsigned &length, int *free_blocks, const bool &longest);
+  int find_free_blocks(const int &needed_blocks, int *free_blocks, const unsigned &goal_group = 0);
+  void release_blocks(const int *blocks, const int &count);
+  const std::vector<unsigned> &file_chain(const dir_entry *entry);
+  void store_chain(const unsigned &first_blk, std::vector<unsigned> &&chain);
+  void drop_chain(unsigned first_blk);
+  void invalidate_chain(const unsigned &block);
+  std::vector<extent> chain_extents(const std::vector<unsigned> &chain);
+  void walk_files(const dir_entry *dir, std::vector<file_ref> &files, std::set<unsigned> &seen);
+  void print_fragmentation(const char *when, std::vector<file_ref> &files);
+  int move_file(file_ref &file, const std::vector<unsigned> &chain);
+  void scan_dir(const dir_entry *dir, std::vector<file_ref> &entries, std::set<unsigned> &seen, unsigned &duplicates, unsigned &bad_records,
+                const bool &repair);
+  void rewrite_attr(const dir_entry *entry);
+  void remove_child(const file_ref &file);
+  void readahead(const std::vector<unsigned> &chain, const unsigned &start, const unsigned &count);
+  int read_blocks(std::vector<block_io> &io);
+  int copy_blocks(const std::vector<unsigned> &src_blocks, const int *dest_blocks, const uint8_t *attr);
 
   std::vector<dir_child *> read_cont_dir(const dir_entry *directory);
-  std::string read_cont_file(const dir_entry *entry);
+  void write_cont_file(const dir_entry *entry, const std::string &content, const int *blocks, const int &count);
+  int place_delayed(const unsigned &first_blk);
+  int flush_delayed(dir_entry *entry);
+  int flush_all_delayed();
+  void drop_delayed(const unsigned &first_blk);
+  std::string read_cont_file(const dir_entry *entry, const unsigned long &offset = 0, unsigned long length = ~0UL);
+  int append_cont_file(dir_entry *entry, const std::string &content);
 
   int format_path(std::string &path_s, path_obj *path);
 
   int calc_needed_blocks(const unsigned long &size);
 
  public:
-  FS();
+  FS(const uint8_t &disk_backend = Disk::get_default_backend(), const unsigned &cache_capacity = CACHE_DEFAULT_CAPACITY);
   ~FS();
 
+  // whether new file systems are checked, or checked and repaired, when
+  // they're mounted
+  static void set_mount_check(const uint8_t &check) { mount_check = check; }
+
   Disk *get_disk();
 
-  int16_t *get_fat();
+  BlockCache *get_cache();
+
+  // the whole FAT, the parts a clean mount left on the disk are read first
+  int32_t *get_fat();
 
-  int16_t get_working_dir_blk_index();
+  uint32_t get_working_dir_blk_index();
 
-  // formats the disk, i.e., creates an empty file system
-  int format();
+  // returns the block of the child of the directory in dir_blk with the given
+  // name, -1 if it has none
+  int lookup(const uint32_t &dir_blk, const std::string &name);
+  // gets the children of the directory in dir_blk in name order, returns -1
+  // if its blocks can't be read
+  int dir_children(const uint32_t &dir_blk, std::vector<dir_child> &children);
+
+  // formats the disk, i.e., creates an empty file system. A size other than 0
+  // resizes the disk to size bytes first
+  int format(const uint64_t &size = 0);
   // create <filepath> creates a new file on the disk, the data content is
   // written on the following rows (ended with an empty row)
   int create(std::string filepath);
@@ -121,6 +444,50 @@ class FS {
   // chmod <accessrights> <filepath> changes the access rights for the
   // file <filepath> to <accessrights>.
   int chmod(std::string accessrights, std::string filepath);
+
+  // sync gives delayed files their blocks and writes them, the FAT and every
+  // dirty block to the disk file
+  int sync();
+
+  // extents [filepath] lists how many extents, runs of adjacent blocks, every
+  // entry in the current directory uses, or the extents of one file
+  int extents(std::string filepath = "");
+
+  // defrag [blocks] moves every file that is split in several extents to a
+  // free extent long enough for all of it. With a budget it stops once it
+  // has moved that many blocks, so it can run a bit at a time
+  int defrag(const unsigned &max_blocks = 0);
+
+  // fsck [repair] checks that the directory tree and the FAT agree: orphaned
+  // chains, blocks in more than one chain, files whose size doesn't match
+  // their chain, names found twice in a directory and stored name hashes
+  // that don't match. The chains are followed by several threads. With
+  // repair the problems are fixed
+  int fsck(const bool &repair = false);
+
+  // operations sharing one write of the FAT, 1 writes it after every one
+  void set_fat_flush_interval(const unsigned &interval) { this->fat_flush_interval = interval > 0 ? interval : 1; }
+
+  // with delayed allocation off, or on a write-through disk, every block of
+  // a new file is chosen when it's created
+  void set_delayed_alloc(const bool &delayed_alloc) { this->delayed_alloc = delayed_alloc; }
+
+  void set_alloc_policy(const uint8_t &policy) { this->alloc_policy = policy; }
+  uint8_t get_alloc_policy() { return this->alloc_policy; }
+
+  // df prints the size of the disk and how many of its blocks are used and
+  // free, from the counts kept while the FAT changes
+  int df();
+
+  // stats prints the I/O statistics of the disk and of every operation,
+  // as one line of JSON when dump is set
+  int stats(const bool &dump = false);
+  // resets every statistic
+  int reset_stats();
+
+  // names answered by the dentry cache and names looked up in a directory
+  unsigned long get_dentry_hits() { return this->dentry_hits; }
+  unsigned long get_dentry_misses() { return this->dentry_misses; }
 };
 
 #endif  // __FS_H__
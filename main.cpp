@@ -1,3 +1,4 @@
+#include <cstring>
 #include "shell.h"
 #include "fs.h"
 #include "disk.h"
@@ -5,6 +6,28 @@
 int
 main(int argc, char **argv)
 {
+    // --disk=stream|mmap|pio|direct picks how the disk file is accessed
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--disk=stream") == 0)
+            Disk::set_default_backend(DISK_BACKEND_STREAM);
+        else if (strcmp(argv[i], "--disk=mmap") == 0)
+            Disk::set_default_backend(DISK_BACKEND_MMAP);
+        else if (strcmp(argv[i], "--disk=pio") == 0)
+            Disk::set_default_backend(DISK_BACKEND_PIO);
+        else if (strcmp(argv[i], "--disk=direct") == 0)
+            Disk::set_default_backend(DISK_BACKEND_DIRECT);
+        // --write-back leaves written blocks dirty until sync or quit
+        else if (strcmp(argv[i], "--write-back") == 0)
+            Disk::set_default_write_mode(DISK_WRITE_BACK);
+        // --fsck checks the file system when it's mounted, --fsck=repair
+        // fixes what it finds as well
+        else if (strcmp(argv[i], "--fsck") == 0)
+            FS::set_mount_check(FSCK_CHECK);
+        else if (strcmp(argv[i], "--fsck=repair") == 0)
+            FS::set_mount_check(FSCK_REPAIR);
+        else
+            std::cerr << "Unknown option: " << argv[i] << std::endl;
+    }
     Shell shell;
     shell.run();
     return 0;
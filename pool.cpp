@@ -0,0 +1,29 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+BlockPool::BlockPool(const unsigned &block_size) { this->block_size = block_size; }
+
+BlockPool::~BlockPool() {
+  for (uint8_t *buffer : buffers) free(buffer);
+}
+
+uint8_t *BlockPool::get() {
+  void *buffer;
+
+  if (!free_buffers.empty()) {
+    buffer = free_buffers.back();
+    free_buffers.pop_back();
+    return (uint8_t *)buffer;
+  }
+
+  if (posix_memalign(&buffer, POOL_ALIGNMENT, block_size) != 0) return nullptr;
+
+  buffers.push_back((uint8_t *)buffer);
+
+  return (uint8_t *)buffer;
+}
+
+void BlockPool::put(uint8_t *buffer) {
+  if (buffer != nullptr) free_buffers.push_back(buffer);
+}
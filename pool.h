@@ -0,0 +1,32 @@
+#include <cstdint>
+#include <vector>
+
+#ifndef __POOL_H__
+#define __POOL_H__
+
+// Disk blocks have to start on this boundary for O_DIRECT.
+#define POOL_ALIGNMENT 4096
+
+// Pool of block sized buffers aligned for O_DIRECT. Buffers are handed back
+// to the pool and reused instead of being allocated for every transfer.
+class BlockPool {
+ private:
+  unsigned block_size;
+  std::vector<uint8_t *> free_buffers;
+  std::vector<uint8_t *> buffers;  // Every buffer the pool allocated
+
+ public:
+  BlockPool(const unsigned &block_size);
+  ~BlockPool();
+
+  // returns an aligned buffer, nullptr if none could be allocated
+  uint8_t *get();
+  // hands a buffer from get() back to the pool
+  void put(uint8_t *buffer);
+
+  unsigned get_allocated() { return buffers.size(); }
+
+  static bool aligned(const void *buffer) { return ((uintptr_t)buffer % POOL_ALIGNMENT) == 0; }
+};
+
+#endif  // __POOL_H__
@@ -1,3 +1,6 @@
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <iostream>
 #include <sstream>
 #include <string>
@@ -9,10 +12,59 @@ std::string commands_str[] = {
     "format", "create", "cat", "ls",
     "cp", "mv", "rm", "append",
     "mkdir", "cd", "pwd",
-    "chmod",
+    "chmod", "sync", "df", "stats", "extents", "defrag", "fsck",
     "help", "quit"
 };
 
+// parses a size in bytes, optionally followed by K, M or G, returns 0 if
+// it isn't a valid size or is more than FAT_MAX_BLOCKS blocks
+static uint64_t
+parse_size(const std::string &str)
+{
+    const uint64_t limit = (uint64_t)FAT_MAX_BLOCKS * BLOCK_SIZE;
+    unsigned long long value;
+    unsigned shift = 0;
+    size_t digits;
+    char *end;
+
+    digits = str.find_first_not_of("0123456789");
+    if (digits == 0 || (digits != std::string::npos && digits + 1 != str.size()))
+        return 0;
+    if (digits != std::string::npos) {
+        switch (str[digits]) {
+            case 'K': case 'k': shift = 10; break;
+            case 'M': case 'm': shift = 20; break;
+            case 'G': case 'g': shift = 30; break;
+            default: return 0;
+        }
+    }
+    errno = 0;
+    value = strtoull(str.c_str(), &end, 10);
+    if (errno == ERANGE || end != str.c_str() + (digits == std::string::npos ? str.size() : digits))
+        return 0;
+    if (value > (limit >> shift))
+        return 0;
+    return (uint64_t)value << shift;
+}
+
+// parses a count of blocks, returns false if it isn't a number or doesn't
+// fit in an unsigned
+static bool
+parse_count(const std::string &str, unsigned &count)
+{
+    unsigned long value;
+    char *end;
+
+    if (str.empty() || str.find_first_not_of("0123456789") != std::string::npos)
+        return false;
+    errno = 0;
+    value = strtoul(str.c_str(), &end, 10);
+    if (errno == ERANGE || *end != '\0' || value > UINT_MAX)
+        return false;
+    count = value;
+    return true;
+}
+
 Shell::Shell()
 {
     std::cout << "Starting shell...\n";
@@ -66,12 +118,12 @@ Shell::run()
         }
 
         if (cmd == "format") {
-            if (cmd_line.size() != 1) {
-                std::cout << "Usage: format\n";
+            if (cmd_line.size() > 2 || (cmd_line.size() == 2 && parse_size(cmd_line[1]) == 0)) {
+                std::cout << "Usage: format [size[K|M|G]]\n";
                 continue;
             }
             // check return value so everything is ok
-            ret_val = filesystem.format();
+            ret_val = filesystem.format(cmd_line.size() == 2 ? parse_size(cmd_line[1]) : 0);
             if (ret_val) {
                 std::cout << "Error: format failed, error code " << ret_val << std::endl;
             }
@@ -232,12 +284,89 @@ Shell::run()
             }
         }
 
+        else if (cmd == "sync") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: sync\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.sync();
+            if (ret_val) {
+                std::cout << "Error: sync failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "df") {
+            if (cmd_line.size() != 1) {
+                std::cout << "Usage: df\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.df();
+            if (ret_val) {
+                std::cout << "Error: df failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "stats") {
+            if (cmd_line.size() > 2 || (cmd_line.size() == 2 && cmd_line[1] != "dump" && cmd_line[1] != "reset")) {
+                std::cout << "Usage: stats [dump|reset]\n";
+                continue;
+            }
+            // check return value so everything is ok
+            if (cmd_line.size() == 2 && cmd_line[1] == "reset")
+                ret_val = filesystem.reset_stats();
+            else
+                ret_val = filesystem.stats(cmd_line.size() == 2);
+            if (ret_val) {
+                std::cout << "Error: stats failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "extents") {
+            if (cmd_line.size() > 2) {
+                std::cout << "Usage: extents [filepath]\n";
+                continue;
+            }
+            arg1 = cmd_line.size() == 2 ? cmd_line[1] : "";
+            // check return value so everything is ok
+            ret_val = filesystem.extents(arg1);
+            if (ret_val) {
+                std::cout << "Error: extents " << arg1 << " failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "defrag") {
+            unsigned max_blocks = 0;
+            if (cmd_line.size() > 2 || (cmd_line.size() == 2 && !parse_count(cmd_line[1], max_blocks))) {
+                std::cout << "Usage: defrag [blocks]\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.defrag(max_blocks);
+            if (ret_val) {
+                std::cout << "Error: defrag failed, error code " << ret_val << std::endl;
+            }
+        }
+
+        else if (cmd == "fsck") {
+            if (cmd_line.size() > 2 || (cmd_line.size() == 2 && cmd_line[1] != "repair")) {
+                std::cout << "Usage: fsck [repair]\n";
+                continue;
+            }
+            // check return value so everything is ok
+            ret_val = filesystem.fsck(cmd_line.size() == 2);
+            if (ret_val) {
+                std::cout << "Error: fsck failed, error code " << ret_val << std::endl;
+            }
+        }
+
         else if (cmd == "quit")
             running = false;
 
         else if (cmd == "help") {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, sync, df, stats, extents, defrag, fsck, help, quit\n";
         }
 
         else if (cmd == "") {
@@ -246,7 +375,7 @@ Shell::run()
 
         else {
             std::cout << "Available commands:\n";
-            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, help, quit\n";
+            std::cout << "format, create, cat, ls, cp, mv, rm, append, mkdir, cd, pwd, chmod, sync, df, stats, extents, defrag, fsck, help, quit\n";
         }
     }
 }
@@ -0,0 +1,73 @@
+#include "stats.h"
+
+#include <sstream>
+
+Histogram::Histogram() { reset(); }
+
+void Histogram::add(const uint64_t &us) {
+  unsigned bucket;
+
+  for (bucket = 0; bucket < STATS_BUCKETS - 1 && us >= (1ULL << bucket); bucket++)
+    ;
+
+  this->buckets[bucket]++;
+  this->count++;
+  this->total_us += us;
+
+  if (us > this->max_us) this->max_us = us;
+}
+
+void Histogram::reset() {
+  unsigned bucket;
+
+  for (bucket = 0; bucket < STATS_BUCKETS; bucket++) this->buckets[bucket] = 0;
+
+  this->count = 0;
+  this->total_us = 0;
+  this->max_us = 0;
+}
+
+uint64_t Histogram::percentile(const unsigned &pct) {
+  uint64_t seen, wanted;
+  unsigned bucket;
+
+  if (this->count == 0) return 0;
+
+  wanted = (this->count * pct + 99) / 100;
+  seen = 0;
+
+  for (bucket = 0; bucket < STATS_BUCKETS - 1; bucket++) {
+    seen += this->buckets[bucket];
+    if (seen >= wanted) break;
+  }
+
+  // The last bucket has no upper bound of its own.
+  return bucket < STATS_BUCKETS - 1 && (1ULL << bucket) < this->max_us ? 1ULL << bucket : this->max_us;
+}
+
+std::string Histogram::to_json() {
+  std::ostringstream out;
+  unsigned bucket;
+
+  out << "[";
+
+  for (bucket = 0; bucket < STATS_BUCKETS; bucket++) out << (bucket > 0 ? "," : "") << this->buckets[bucket];
+
+  out << "]";
+
+  return out.str();
+}
+
+OpScope::OpScope(op_stats *op, const io_stats *reads, const io_stats *writes) {
+  this->op = op;
+  this->reads = reads;
+  this->writes = writes;
+  this->start_read = reads->blocks;
+  this->start_written = writes->blocks;
+}
+
+OpScope::~OpScope() {
+  this->op->latency.add(this->timer.elapsed_us());
+  this->op->blocks_read += this->reads->blocks - this->start_read;
+  this->op->blocks_written += this->writes->blocks - this->start_written;
+}
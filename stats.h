@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+// Bucket i of a histogram counts latencies below 2^i microseconds, the last
+// bucket counts everything slower.
+#define STATS_BUCKETS 24
+
+typedef std::chrono::steady_clock stats_clock;
+
+// Latency histogram with power of two buckets.
+class Histogram {
+ private:
+  uint64_t buckets[STATS_BUCKETS];
+  uint64_t count;
+  uint64_t total_us;
+  uint64_t max_us;
+
+ public:
+  Histogram();
+
+  void add(const uint64_t &us);
+  void reset();
+
+  // upper bound of the bucket the given percentile (0-100) falls in
+  uint64_t percentile(const unsigned &pct);
+
+  uint64_t get_bucket(const unsigned &bucket) { return buckets[bucket]; }
+  uint64_t get_count() { return count; }
+  uint64_t get_total_us() { return total_us; }
+  uint64_t get_max_us() { return max_us; }
+  uint64_t get_avg_us() { return count > 0 ? total_us / count : 0; }
+
+  // the buckets as a JSON array
+  std::string to_json();
+};
+
+// Calls into the disk of one kind, e.g. reads.
+struct io_stats {
+  uint64_t blocks = 0;  // Blocks moved by the calls
+  Histogram latency;    // One entry per call
+};
+
+// Calls of one file system operation, e.g. cat.
+struct op_stats {
+  uint64_t blocks_read = 0;     // Blocks read from the disk by the calls
+  uint64_t blocks_written = 0;  // Blocks written to the disk by the calls
+  Histogram latency;            // One entry per call
+};
+
+// Measures the time since it was created.
+class StatsTimer {
+ private:
+  stats_clock::time_point start;
+
+ public:
+  StatsTimer() : start(stats_clock::now()) {}
+
+  uint64_t elapsed_us() { return std::chrono::duration_cast<std::chrono::microseconds>(stats_clock::now() - start).count(); }
+};
+
+// Adds one call to an operation when it goes out of scope, together with the
+// blocks read and written in the meantime.
+class OpScope {
+ private:
+  op_stats *op;
+  const io_stats *reads, *writes;
+  uint64_t start_read, start_written;
+  StatsTimer timer;
+
+ public:
+  OpScope(op_stats *op, const io_stats *reads, const io_stats *writes);
+  ~OpScope();
+};
+
+#endif  // __STATS_H__
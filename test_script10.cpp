@@ -0,0 +1,162 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+#include "codec.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+// reads the state and the free block count from the superblock on the disk
+static void
+read_superblock(uint32_t &state, uint32_t &free_blocks)
+{
+    uint8_t block[BLOCK_SIZE] = {0};
+    int fd;
+
+    fd = open(DISKNAME, O_RDONLY);
+    pread(fd, block, BLOCK_SIZE, (off_t)SUPER_BLOCK * BLOCK_SIZE);
+    close(fd);
+    state = codec::get_le32(block + SB_STATE_OFFSET);
+    free_blocks = codec::get_le32(block + SB_FREE_BLOCKS_OFFSET);
+}
+
+// counts the free blocks in the FAT of a mounted file system
+static uint32_t
+count_free(FS *fs)
+{
+    int32_t *fat = fs->get_fat();
+    uint32_t free_blocks = 0;
+
+    for (unsigned i = 0; i < fs->get_disk()->get_no_blocks(); i++)
+        if (fat[i] == FAT_FREE)
+            free_blocks++;
+    return free_blocks;
+}
+
+// prints what the superblock says and whether it's what was expected
+static void
+check_superblock(const uint32_t &expected_state, const uint32_t &expected_free)
+{
+    uint32_t state, free_blocks;
+
+    read_superblock(state, free_blocks);
+    std::cout << "Expected output:" << std::endl;
+    std::cout << (expected_state == SB_STATE_CLEAN ? "clean" : "dirty") << ", " << expected_free << " free blocks" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << (state == SB_STATE_CLEAN ? "clean" : "dirty") << ", " << free_blocks << " free blocks" << std::endl;
+    if (state != expected_state || free_blocks != expected_free)
+        std::cout << "Error: the superblock doesn't match" << std::endl;
+}
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1;
+    std::ofstream input;
+    uint32_t free_blocks, state;
+    FS *fs;
+    int fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 10 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing remounts..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/\" as test dir..." << std::endl;
+    filesystem.format();
+
+    input.open("input10.txt");
+    input << "first mount" << "\n\n" << "second mount" << "\n\n";
+    input.close();
+    fw = open("input10.txt", O_RDONLY);
+    dup2(fw,0);
+
+    // The shell's file system stays mounted but idle, the disk is mounted
+    // again below as if by the next run.
+    std::cout << "mounting, creating f1 and unmounting..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "The file system wasn't unmounted cleanly, counting free blocks." << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    fs = new FS();
+    arg1 = "f1";
+    fs->create(arg1);
+    std::cout << "while it's mounted..." << std::endl;
+    read_superblock(state, free_blocks);
+    check_superblock(SB_STATE_DIRTY, free_blocks);
+    free_blocks = count_free(fs);
+    delete fs;
+    std::cout << "after a clean unmount..." << std::endl;
+    check_superblock(SB_STATE_CLEAN, free_blocks);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "mounting again, creating f2 and crashing..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "no message about an unclean unmount" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    fs = new FS();
+    if (count_free(fs) != free_blocks)
+        std::cout << "Error: the clean mount didn't take the free count from the superblock" << std::endl;
+    arg1 = "f2";
+    fs->create(arg1);
+    free_blocks = count_free(fs);
+    // Never unmounted, as if the process was killed.
+    fs = nullptr;
+    std::cout << "after a crash..." << std::endl;
+    read_superblock(state, free_blocks);
+    check_superblock(SB_STATE_DIRTY, free_blocks);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "mounting after the crash..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "The file system wasn't unmounted cleanly, counting free blocks." << std::endl;
+    std::cout << "second mount" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    fs = new FS();
+    arg1 = "f2";
+    fs->cat(arg1);
+    free_blocks = count_free(fs);
+    delete fs;
+    std::cout << "after a clean unmount..." << std::endl;
+    check_superblock(SB_STATE_CLEAN, free_blocks);
+    close(fw);
+    unlink("input10.txt");
+
+    // The shell's file system is unmounted last, it leaves an empty disk.
+    filesystem.format();
+    PRINTDIV2;
+
+    std::cout << "... Task 10 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+// whether a block reads as zeros, straight from the disk file and through
+// the disk
+static bool
+reads_zeros(FS &fs, const unsigned &block_no)
+{
+    uint8_t block[BLOCK_SIZE];
+    int fd;
+
+    fd = open(DISKNAME, O_RDONLY);
+    pread(fd, block, BLOCK_SIZE, (off_t)block_no * BLOCK_SIZE);
+    close(fd);
+    for (unsigned i = 0; i < BLOCK_SIZE; i++)
+        if (block[i] != 0)
+            return false;
+    fs.get_disk()->read(block_no, block);
+    for (unsigned i = 0; i < BLOCK_SIZE; i++)
+        if (block[i] != 0)
+            return false;
+    return true;
+}
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1;
+    std::ofstream input;
+    std::vector<int> blocks;
+    unsigned zeros;
+    int32_t *fat;
+    int block, fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 11 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing freed blocks..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/\" as test dir..." << std::endl;
+    filesystem.format();
+
+    // A file of three blocks and one after it.
+    input.open("input11.txt");
+    input << std::string(9000, 'a') << "\n\n" << "f2" << "\n\n";
+    input.close();
+    fw = open("input11.txt", O_RDONLY);
+    dup2(fw,0);
+    arg1 = "f1";
+    filesystem.create(arg1);
+    arg1 = "f2";
+    filesystem.create(arg1);
+    close(fw);
+    unlink("input11.txt");
+
+    fat = filesystem.get_fat();
+    for (block = filesystem.lookup(filesystem.get_working_dir_blk_index(), "f1"); block != FAT_EOF; block = fat[block])
+        blocks.push_back(block);
+
+    for (int used : blocks)
+        if (reads_zeros(filesystem, used))
+            std::cout << "Error: block " << used << " of f1 reads as zeros before it's freed" << std::endl;
+
+    std::cout << "rm(f1)..." << std::endl;
+    arg1 = "f1";
+    filesystem.rm(arg1);
+
+    std::cout << "reading the blocks f1 had..." << std::endl;
+    zeros = 0;
+    for (int freed : blocks)
+        if (reads_zeros(filesystem, freed))
+            zeros++;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << blocks.size() << " of 3 blocks read as zeros" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << zeros << " of " << blocks.size() << " blocks read as zeros" << std::endl;
+    if (blocks.size() != 3 || zeros != blocks.size())
+        std::cout << "Error: the freed blocks still have data" << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f2)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "f2" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f2";
+    filesystem.cat(arg1);
+    PRINTDIV2;
+
+    std::cout << "... Task 11 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1;
+    int fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 6 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing missing names..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/\" as test dir..." << std::endl;
+    filesystem.format();
+    fw = open("input1.txt", O_RDONLY);
+    dup2(fw,0);
+    arg1 = "f1";
+    filesystem.create(arg1);
+    close(fw);
+    filesystem.reset_stats();
+
+    std::cout << "cat(nofile)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "nofile doesn't exist." << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "nofile";
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(nofile) again..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "nofile doesn't exist." << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "checking name lookups..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "1 looked up, 1 cached" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << filesystem.get_dentry_misses() << " looked up, " << filesystem.get_dentry_hits() << " cached" << std::endl;
+    if (filesystem.get_dentry_misses() != 1 || filesystem.get_dentry_hits() != 1)
+        std::cout << "Error: the second cat(nofile) wasn't answered by the dentry cache" << std::endl;
+    PRINTDIV2;
+
+    std::cout << "... Task 6 done" << std::endl;
+    PRINTDIV;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+#define NO_FILES 200
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1;
+    std::ofstream input;
+    int fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 7 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing a directory of many files..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/big\" as test dir..." << std::endl;
+    filesystem.format();
+    arg1 = "big";
+    filesystem.mkdir(arg1);
+    filesystem.cd(arg1);
+
+    // One file of input for every create, each ends with an empty line.
+    input.open("input7.txt");
+    for (int i = 1; i <= NO_FILES; i++)
+        input << "content of f" << i << "\n\n";
+    input.close();
+
+    std::cout << "creating f1 ... f" << NO_FILES << " ..." << std::endl;
+    fw = open("input7.txt", O_RDONLY);
+    dup2(fw,0);
+    for (int i = 1; i <= NO_FILES; i++) {
+        arg1 = "f" + std::to_string(i);
+        filesystem.create(arg1);
+    }
+    close(fw);
+    unlink("input7.txt");
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f1)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "content of f1" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f1";
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f" << NO_FILES << ")..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "content of f" << NO_FILES << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f" + std::to_string(NO_FILES);
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "rm(f1), rm(f" << NO_FILES << ") and every tenth file..." << std::endl;
+    for (int i = 1; i <= NO_FILES; i++) {
+        if (i == 1 || i == NO_FILES || i % 10 == 0) {
+            arg1 = "f" + std::to_string(i);
+            filesystem.rm(arg1);
+        }
+    }
+    std::cout << "cat(f1)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "f1 doesn't exist." << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f1";
+    filesystem.cat(arg1);
+    std::cout << "cat(f199)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "content of f199" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f199";
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "checking the listing..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << NO_FILES - NO_FILES / 10 - 1 << " files, f2 ... f199 without f10, f20, ..." << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::vector<dir_child> children;
+    filesystem.dir_children(filesystem.get_working_dir_blk_index(), children);
+    std::cout << children.size() << " files" << std::endl;
+    if (children.size() != NO_FILES - NO_FILES / 10 - 1)
+        std::cout << "Error: the directory lists " << children.size() << " files" << std::endl;
+    filesystem.ls();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "fsck..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "No problems found" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck();
+    PRINTDIV2;
+
+    std::cout << "... Task 7 done" << std::endl;
+    PRINTDIV;
+}
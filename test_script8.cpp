@@ -0,0 +1,120 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1;
+    std::ofstream input;
+    int32_t *fat;
+    int f1, f2, fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 8 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing fsck..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/\" as test dir..." << std::endl;
+    filesystem.format();
+
+    // Two files of three blocks each.
+    input.open("input8.txt");
+    input << std::string(9000, 'a') << "\n\n" << std::string(9000, 'b') << "\n\n";
+    input.close();
+    fw = open("input8.txt", O_RDONLY);
+    dup2(fw,0);
+    arg1 = "f1";
+    filesystem.create(arg1);
+    arg1 = "f2";
+    filesystem.create(arg1);
+    close(fw);
+    unlink("input8.txt");
+
+    std::cout << "fsck on a clean disk..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "No problems found" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck();
+    std::cout << "-----" << std::endl;
+
+    // The second block of f1 links to the first block of f2.
+    f1 = filesystem.lookup(filesystem.get_working_dir_blk_index(), "f1");
+    f2 = filesystem.lookup(filesystem.get_working_dir_blk_index(), "f2");
+    fat = filesystem.get_fat();
+    std::cout << "linking the second block of f1 to f2..." << std::endl;
+    fat[fat[f1]] = f2;
+
+    std::cout << "fsck..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "Cross-linked: f1 shares block " << f2 << " with another entry" << std::endl;
+    std::cout << "Orphaned: 1 blocks in 1 chains" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "fsck repair..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "Repaired" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck(true);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "fsck after the repair..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "No problems found" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck();
+    std::cout << "-----" << std::endl;
+
+    std::cout << "checking that f2 was kept and f1 cut..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "name\t size" << std::endl;
+    std::cout << "f1\t 8048" << std::endl;
+    std::cout << "f2\t 9001" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.ls();
+    std::vector<dir_child> children;
+    filesystem.dir_children(filesystem.get_working_dir_blk_index(), children);
+    if (children.size() != 2 || children[0].size != 8048 || children[1].size != 9001)
+        std::cout << "Error: fsck repair didn't cut f1 at the block it shares with f2" << std::endl;
+    PRINTDIV2;
+
+    std::cout << "... Task 8 done" << std::endl;
+    PRINTDIV;
+}
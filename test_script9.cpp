@@ -0,0 +1,131 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include "test_script.h"
+#include "fs.h"
+
+#define PRINTDIV std::cout <<  "================================================================================" << std::endl
+#define PRINTDIV2 std::cout << "----------------------------------------" << std::endl
+
+std::string commands_str[] = {
+    "format", "create", "cat", "ls",
+    "cp", "mv", "rm", "append",
+    "mkdir", "cd", "pwd",
+    "chmod",
+    "help", "quit"
+};
+
+// counts the runs of adjacent blocks in the chain starting at block
+static int
+count_extents(int32_t *fat, int block)
+{
+    int extents = 1;
+
+    while (fat[block] != FAT_EOF) {
+        if (fat[block] != block + 1)
+            extents++;
+        block = fat[block];
+    }
+    return extents;
+}
+
+Shell::Shell()
+{
+    std::cout << "Creating and starting shell...\n";
+}
+
+Shell::~Shell()
+{
+    std::cout << "Exiting shell...\n";
+}
+
+void
+Shell::run()
+{
+    std::string arg1, arg2;
+    std::ofstream input;
+    int before, after, fw;
+
+    PRINTDIV;
+    std::cout << "\\ / \\ / \\ / \\ / \\ / \\ / \\     new test session     / \\ / \\ / \\ / \\ / \\ / \\ / \\ /" << std::endl;
+    PRINTDIV;
+    std::cout << "Starting test sequence..." << std::endl;
+    PRINTDIV;
+    std::cout << "Task 9 ..." << std::endl;
+    PRINTDIV2;
+
+    std::cout << "Testing defrag..." << std::endl;
+    std::cout << "Starting with empty disk..." << std::endl;
+    std::cout << "Use \"/\" as test dir..." << std::endl;
+    filesystem.format();
+
+    // f1 fills most of a block, f2 and f3 come right after it.
+    input.open("input9.txt");
+    input << std::string(4000, 'a') << "\n\n" << "f2" << "\n\n" << std::string(100, 'c') << "\n\n";
+    input.close();
+    fw = open("input9.txt", O_RDONLY);
+    dup2(fw,0);
+    arg1 = "f1";
+    filesystem.create(arg1);
+    arg1 = "f2";
+    filesystem.create(arg1);
+    arg1 = "f3";
+    filesystem.create(arg1);
+    close(fw);
+    unlink("input9.txt");
+
+    std::cout << "append(f3,f1)..." << std::endl;
+    arg1 = "f3";
+    arg2 = "f1";
+    filesystem.append(arg1, arg2);
+    before = count_extents(filesystem.get_fat(), filesystem.lookup(filesystem.get_working_dir_blk_index(), "f1"));
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "f1 in 2 extents" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << "f1 in " << before << " extents" << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "defrag..." << std::endl;
+    filesystem.defrag();
+    after = count_extents(filesystem.get_fat(), filesystem.lookup(filesystem.get_working_dir_blk_index(), "f1"));
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "f1 in 1 extents" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    std::cout << "f1 in " << after << " extents" << std::endl;
+    if (before < 2 || after != 1)
+        std::cout << "Error: defrag didn't bring f1 together, " << before << " extents before and " << after << " after" << std::endl;
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f1)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << std::string(4000, 'a') << std::endl << std::string(100, 'c') << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f1";
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "cat(f2)..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "f2" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    arg1 = "f2";
+    filesystem.cat(arg1);
+    std::cout << "-----" << std::endl;
+
+    std::cout << "fsck..." << std::endl;
+    std::cout << "Expected output:" << std::endl;
+    std::cout << "No problems found" << std::endl;
+    std::cout << "Actual output:" << std::endl;
+    filesystem.fsck();
+    PRINTDIV2;
+
+    std::cout << "... Task 9 done" << std::endl;
+    PRINTDIV;
+}